@@ -0,0 +1,158 @@
+#include "auroraframe.h"
+
+
+static const uint16_t crcTable[256] PROGMEM = {
+    0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
+    0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
+    0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
+    0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
+    0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
+    0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
+    0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
+    0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
+    0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
+    0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
+    0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
+    0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
+    0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
+    0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
+    0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
+    0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
+    0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
+    0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
+    0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
+    0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
+    0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
+    0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
+    0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
+    0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
+    0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
+    0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
+    0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
+    0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
+    0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
+    0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
+    0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
+    0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78,
+};
+
+
+uint16_t AuroraFrame::crc16(const uint8_t *buf, size_t len) {
+    uint16_t crc = 0xffff;
+    while (len--) {
+        crc = (crc >> 8) ^ pgm_read_word(&crcTable[(crc ^ *buf++) & 0xff]);
+    }
+    return ~crc;
+}
+
+void AuroraFrame::encode(uint8_t *frame, uint8_t address, uint8_t op, const uint8_t *params) {
+    frame[0] = address;
+    frame[1] = op;
+    if (params) {
+        memcpy(&frame[2], params, 6);
+    } else {
+        memset(&frame[2], 0, 6);
+    }
+    uint16_t crc = crc16(frame, 8);
+    frame[8] = crc & 0xff;
+    frame[9] = crc >> 8;
+}
+
+uint8_t AuroraFrame::decode(const uint8_t *frame, AuroraReply *reply) {
+    uint16_t crc = crc16(frame, 6);
+    reply->transmissionState = frame[0];
+    reply->globalState = frame[1];
+    memcpy(reply->data, &frame[2], sizeof(reply->data));
+    if (frame[6] != (crc & 0xff) || frame[7] != (crc >> 8)) {
+        reply->result = AURORA_BAD_CRC;
+    } else if (reply->transmissionState != 0) {
+        reply->result = AURORA_REFUSED;
+    } else {
+        reply->result = AURORA_OK;
+    }
+    return reply->result;
+}
+
+uint32_t AuroraFrame::dataU32(const AuroraReply *reply) {
+    return ((uint32_t)reply->data[0] << 24) | ((uint32_t)reply->data[1] << 16) | ((uint32_t)reply->data[2] << 8) | reply->data[3];
+}
+
+float AuroraFrame::dataFloat(const AuroraReply *reply) {
+    uint32_t bits = dataU32(reply);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+PGM_P AuroraFrame::resultText(uint8_t result) {
+    switch (result) {
+        case AURORA_OK:      return PSTR("ok");
+        case AURORA_TIMEOUT: return PSTR("timeout");
+        case AURORA_BAD_CRC: return PSTR("bad crc");
+        case AURORA_REFUSED: return PSTR("refused");
+        case AURORA_BAD_FRAME: return PSTR("bad frame");
+    }
+    return NULL;
+}
+
+PGM_P AuroraFrame::transmissionStateText(uint8_t state) {
+    switch (state) {
+        case 0:  return PSTR("Everything is OK");
+        case 51: return PSTR("Command is not implemented");
+        case 52: return PSTR("Variable does not exist");
+        case 53: return PSTR("Variable value is out of range");
+        case 54: return PSTR("EEprom not accessible");
+        case 55: return PSTR("Not Toggled Service Mode");
+        case 56: return PSTR("Can not send the command to internal micro");
+        case 57: return PSTR("Command not Executed");
+        case 58: return PSTR("The variable is not available, retry");
+    }
+    return NULL;
+}
+
+PGM_P AuroraFrame::globalStateText(uint8_t state) {
+    switch (state) {
+        case 0:  return PSTR("Sending Parameters");
+        case 1:  return PSTR("Wait Sun / Grid");
+        case 2:  return PSTR("Checking Grid");
+        case 3:  return PSTR("Measuring Riso");
+        case 4:  return PSTR("DcDc Start");
+        case 5:  return PSTR("Inverter Start");
+        case 6:  return PSTR("Run");
+        case 7:  return PSTR("Recovery");
+        case 8:  return PSTR("Pause");
+        case 9:  return PSTR("Ground Fault");
+        case 10: return PSTR("OTH Fault");
+        case 11: return PSTR("Address Setting");
+        case 12: return PSTR("Self Test");
+        case 13: return PSTR("Self Test Fail");
+        case 14: return PSTR("Sensor Test + Meas.Riso");
+        case 15: return PSTR("Leak Fault");
+        case 16: return PSTR("Waiting for manual reset");
+        case 17: return PSTR("Internal Error E026");
+        case 18: return PSTR("Internal Error E027");
+        case 19: return PSTR("Internal Error E028");
+        case 20: return PSTR("Internal Error E029");
+        case 21: return PSTR("Internal Error E030");
+        case 22: return PSTR("Sending Wind Table");
+        case 23: return PSTR("Failed Sending table");
+        case 24: return PSTR("UTH Fault");
+        case 25: return PSTR("Remote OFF");
+        case 26: return PSTR("Interlock Fail");
+        case 27: return PSTR("Executing Autotest");
+        case 30: return PSTR("Waiting Sun");
+        case 31: return PSTR("Temperature Fault");
+        case 32: return PSTR("Fan Stuck");
+        case 33: return PSTR("Int. Com. Fault");
+        case 34: return PSTR("Slave Insertion");
+        case 35: return PSTR("DC Switch Open");
+        case 36: return PSTR("TRAS Switch Open");
+        case 37: return PSTR("MASTER Exclusion");
+        case 38: return PSTR("Auto Exclusion");
+        case 98: return PSTR("Erasing Internal EEprom");
+        case 99: return PSTR("Erasing External EEprom");
+        case 100: return PSTR("Counting EEprom");
+        case 101: return PSTR("Freeze");
+    }
+    return NULL;
+}
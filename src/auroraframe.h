@@ -0,0 +1,79 @@
+#ifndef AURORAFRAME_H
+#define AURORAFRAME_H
+
+#include <Arduino.h>
+
+#define AURORA_REQUEST_SIZE 10 // Address, command, 6 parameter bytes, CRC
+#define AURORA_REPLY_SIZE   8  // Transmission state, global state, 4 data bytes, CRC
+#define AURORA_EPOCH_OFFSET 946684800UL // Inverter time counts seconds from 2000-01-01
+
+// Command codes
+#define AURORA_OP_STATE         50
+#define AURORA_OP_DSP           59
+#define AURORA_OP_TIME_READ     70
+#define AURORA_OP_TIME_WRITE    71
+#define AURORA_OP_CUMULATED     78
+
+// AURORA_OP_DSP measurement types
+#define AURORA_DSP_GRID_VOLTAGE       1
+#define AURORA_DSP_GRID_CURRENT       2
+#define AURORA_DSP_GRID_POWER         3
+#define AURORA_DSP_FREQUENCY          4
+#define AURORA_DSP_ILEAK_DCDC         6
+#define AURORA_DSP_ILEAK_INVERTER     7
+#define AURORA_DSP_PIN1               8
+#define AURORA_DSP_PIN2               9
+#define AURORA_DSP_INVERTER_TEMP      21
+#define AURORA_DSP_BOOSTER_TEMP       22
+#define AURORA_DSP_INPUT1_VOLTAGE     23
+#define AURORA_DSP_INPUT1_CURRENT     25
+#define AURORA_DSP_INPUT2_VOLTAGE     26
+#define AURORA_DSP_INPUT2_CURRENT     27
+#define AURORA_DSP_ISOLATION          30
+
+// AURORA_OP_DSP second parameter: 1 reads the global measurement, 0 the module one (the only choice on a slave)
+#define AURORA_DSP_GLOBAL 1
+
+// AURORA_OP_CUMULATED periods
+#define AURORA_ENERGY_DAILY    0
+#define AURORA_ENERGY_WEEKLY   1
+#define AURORA_ENERGY_MONTHLY  3
+#define AURORA_ENERGY_YEARLY   4
+#define AURORA_ENERGY_LIFETIME 5
+
+// Request outcome
+#define AURORA_OK       0
+#define AURORA_TIMEOUT  1 // No or short reply
+#define AURORA_BAD_CRC  2
+#define AURORA_REFUSED  3 // Valid reply with a non zero transmission state
+#define AURORA_BAD_FRAME 4 // Reply cut short
+#define AURORA_RESULT_COUNT 5
+
+#define AURORA_STATE_RETRY 58 // Transmission state: variable not available, retry
+
+
+struct AuroraReply {
+    uint8_t result;
+    uint8_t transmissionState;
+    uint8_t globalState;
+    uint8_t data[4];
+};
+
+
+// Aurora protocol frames in caller provided buffers, no allocation. Codes map to text in flash, for logging only.
+class AuroraFrame {
+    public:
+        // CRC-16/X-25 as used by the protocol, table driven
+        static uint16_t crc16(const uint8_t *buf, size_t len);
+        // params may be NULL, otherwise 6 bytes
+        static void encode(uint8_t *frame, uint8_t address, uint8_t op, const uint8_t *params);
+        // Fills reply and returns reply->result
+        static uint8_t decode(const uint8_t *frame, AuroraReply *reply);
+        static float dataFloat(const AuroraReply *reply);
+        static uint32_t dataU32(const AuroraReply *reply);
+        // Text for codes, NULL if unknown
+        static PGM_P resultText(uint8_t result);
+        static PGM_P transmissionStateText(uint8_t state);
+        static PGM_P globalStateText(uint8_t state);
+};
+#endif    // AURORAFRAME_H
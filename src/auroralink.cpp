@@ -0,0 +1,196 @@
+#include "auroralink.h"
+
+
+AuroraLink::AuroraLink(Stream *serial, uint8_t txCtlPin):
+    _serial(serial), _txCtlPin(txCtlPin), _rxLen(0), _attempt(0), _waiting(false), _done(false), _probe(false), _startUs(0), _sentUs(0),
+    _polledUs(0), _replyEndUs(0), _replyTimed(false), _timeoutUs(0), _lastUs(0), _idleUs(0), _busyUs(0), _retries(0), _timeouts(0), _latencyCount(0) {
+    memset(&_reply, 0, sizeof(_reply));
+}
+
+void AuroraLink::begin() {
+    pinMode(_txCtlPin, OUTPUT);
+    digitalWrite(_txCtlPin, LOW);
+    _idleUs = micros();
+}
+
+AuroraLink::Latency *AuroraLink::_findLatency(uint8_t op, bool create) {
+    for (uint8_t i = 0; i < _latencyCount; i++) {
+        if (_latency[i].op == op) {
+            return &_latency[i];
+        }
+    }
+    if (!create || _latencyCount >= AURORA_LINK_OPS) {
+        return NULL;
+    }
+    Latency *latency = &_latency[_latencyCount++];
+    latency->op = op;
+    latency->srttUs = 0;
+    latency->rttvarUs = 0;
+    return latency;
+}
+
+// RFC 6298 smoothing, gains 1/8 and 1/4
+void AuroraLink::_observe(uint8_t op, unsigned long us) {
+    Latency *latency = _findLatency(op, true);
+    if (!latency) {
+        return;
+    }
+    if (latency->srttUs == 0) {
+        latency->srttUs = us;
+        latency->rttvarUs = us / 2;
+        return;
+    }
+    uint32_t delta = latency->srttUs > us ? latency->srttUs - us : us - latency->srttUs;
+    latency->rttvarUs = latency->rttvarUs - latency->rttvarUs / 4 + delta / 4;
+    latency->srttUs = latency->srttUs - latency->srttUs / 8 + us / 8;
+}
+
+unsigned long AuroraLink::timeoutUs(uint8_t op) {
+    Latency *latency = _findLatency(op, false);
+    if (!latency || latency->srttUs == 0) {
+        return AURORA_TIMEOUT_MS * 1000UL;
+    }
+    unsigned long us = latency->srttUs + 4 * latency->rttvarUs + AURORA_TIMEOUT_MARGIN_MS * 1000UL;
+    return constrain(us, AURORA_TIMEOUT_MIN_MS * 1000UL, AURORA_TIMEOUT_MS * 1000UL);
+}
+
+void AuroraLink::_transmit() {
+    while (micros() - _idleUs < AURORA_FRAME_GAP_US) {
+        // Wait out the inter-frame gap
+    }
+    // Discard stale bytes, e.g. a late reply to a request that timed out
+    while (_serial->available()) {
+        _serial->read();
+    }
+    _sentUs = micros();
+    digitalWrite(_txCtlPin, HIGH);
+    _serial->write(_tx, sizeof(_tx));
+    _serial->flush();
+    digitalWrite(_txCtlPin, LOW);
+    _rxLen = 0;
+    _replyTimed = false;
+    _polledUs = micros();
+    _waiting = true;
+    _done = false;
+}
+
+void AuroraLink::_receive() {
+    uint8_t seen = _rxLen;
+    while (_rxLen < sizeof(_rx) && _serial->available()) {
+        _rx[_rxLen++] = _serial->read();
+    }
+    unsigned long now = micros();
+    bool timely = now - _polledUs <= AURORA_POLL_GAP_US;
+    _polledUs = now;
+    if (timely && seen == 0 && _rxLen > 0) {
+        // The rest of the reply follows at line speed, whenever it is collected
+        _replyEndUs = now + (sizeof(_rx) - _rxLen) * AURORA_BYTE_US;
+        _replyTimed = true;
+    }
+    unsigned long elapsed = now - _sentUs;
+    bool timed;
+    bool retry;
+    if (_rxLen == sizeof(_rx)) {
+        timed = _replyTimed;
+        if (timed && !timely) {
+            elapsed = _replyEndUs - _sentUs;
+        }
+        uint8_t result = AuroraFrame::decode(_rx, &_reply);
+        if (timed && result != AURORA_BAD_CRC) {
+            _observe(_tx[1], elapsed);
+        }
+        retry = result == AURORA_BAD_CRC || (result == AURORA_REFUSED && _reply.transmissionState == AURORA_STATE_RETRY);
+    } else if (elapsed >= _timeoutUs) {
+        // A late poll still waited no longer than the timeout on the bus
+        timed = true;
+        elapsed = _timeoutUs;
+        memset(&_reply, 0, sizeof(_reply));
+        _reply.result = _rxLen > 0 ? AURORA_BAD_FRAME : AURORA_TIMEOUT;
+        if (_probe && _rxLen == 0) {
+            retry = false;
+        } else {
+            _timeouts++;
+            // A short adaptive timeout may have fired early, retry once with the full timeout
+            retry = _rxLen > 0 || _timeoutUs < AURORA_TIMEOUT_MS * 1000UL;
+        }
+    } else {
+        return;
+    }
+    if (timed) {
+        _busyUs += elapsed;
+    }
+    _idleUs = now;
+    if (retry && _attempt < AURORA_RETRIES) {
+        _attempt++;
+        _retries++;
+        if (_reply.result == AURORA_TIMEOUT) {
+            _timeoutUs = AURORA_TIMEOUT_MS * 1000UL;
+        }
+        _transmit();
+        return;
+    }
+    _lastUs = timed ? _sentUs + elapsed - _startUs : 0;
+    _waiting = false;
+    _done = true;
+}
+
+bool AuroraLink::ready() {
+    return !_waiting && !_done && micros() - _idleUs >= AURORA_FRAME_GAP_US;
+}
+
+void AuroraLink::send(uint8_t address, uint8_t op, const uint8_t *params, unsigned long probeTimeoutUs) {
+    AuroraFrame::encode(_tx, address, op, params);
+    _attempt = 0;
+    _probe = probeTimeoutUs != 0;
+    _timeoutUs = _probe ? probeTimeoutUs : timeoutUs(op);
+    _startUs = micros();
+    _transmit();
+}
+
+uint8_t AuroraLink::poll(AuroraReply *reply) {
+    if (_waiting) {
+        _receive();
+    }
+    if (!_done) {
+        return AURORA_PENDING;
+    }
+    _done = false;
+    *reply = _reply;
+    return reply->result;
+}
+
+uint8_t AuroraLink::request(uint8_t address, uint8_t op, const uint8_t *params, AuroraReply *reply) {
+    while (_waiting) {
+        _receive();
+        yield();
+    }
+    bool savedDone = _done;
+    AuroraReply saved = _reply;
+    unsigned long savedLastUs = _lastUs;
+    send(address, op, params);
+    while (_waiting) {
+        _receive();
+        yield();
+    }
+    *reply = _reply;
+    _done = savedDone;
+    _reply = saved;
+    _lastUs = savedLastUs;
+    return reply->result;
+}
+
+unsigned long AuroraLink::lastUs() {
+    return _lastUs;
+}
+
+uint64_t AuroraLink::busyUs() {
+    return _busyUs;
+}
+
+uint32_t AuroraLink::retries() {
+    return _retries;
+}
+
+uint32_t AuroraLink::timeouts() {
+    return _timeouts;
+}
@@ -0,0 +1,110 @@
+#ifndef AURORALINK_H
+#define AURORALINK_H
+
+#include <Arduino.h>
+#include "auroraframe.h"
+
+#ifndef AURORA_BAUD
+#define AURORA_BAUD 19200
+#endif
+
+#ifndef AURORA_TIMEOUT_MS
+#define AURORA_TIMEOUT_MS 500 // Longest wait for a reply, used until a command has a latency estimate
+#endif
+
+#ifndef AURORA_TIMEOUT_MIN_MS
+#define AURORA_TIMEOUT_MIN_MS 30 // Shortest adaptive timeout, a reply alone takes over 4 ms on the wire
+#endif
+
+#ifndef AURORA_TIMEOUT_MARGIN_MS
+#define AURORA_TIMEOUT_MARGIN_MS 10 // Added to the latency estimate
+#endif
+
+#ifndef AURORA_RETRIES
+#define AURORA_RETRIES 2 // Resends after a transient failure
+#endif
+
+#ifndef AURORA_LINK_OPS
+#define AURORA_LINK_OPS 8 // Command types with a latency estimate
+#endif
+
+#ifndef AURORA_FRAME_GAP_US
+#define AURORA_FRAME_GAP_US 2000 // Bus idle time before a new request, 3.5 character times at 19200 baud rounded up
+#endif
+
+#ifndef AURORA_POLL_GAP_US
+#define AURORA_POLL_GAP_US 5000 // Longest gap between polls for a reply to still be timed by the poll that sees it
+#endif
+
+#define AURORA_BYTE_US (10 * 1000000UL / AURORA_BAUD)
+#define AURORA_PENDING 0xff // poll() result while the reply is outstanding
+
+
+// Half duplex RS485 link to Aurora inverters. The serial port is opened by the caller at AURORA_BAUD.
+// One request is in flight at a time, either asynchronous with send() and poll(), or blocking with request().
+//
+// Timeouts adapt per command type to the measured reply latency, as smoothed latency plus four times its mean
+// deviation (the TCP retransmit timer estimator), which sits above the 99th percentile for the narrow latency
+// spread of a healthy link. Bad CRC, cut short replies, "retry" refusals and timeouts shorter than
+// AURORA_TIMEOUT_MS are resent up to AURORA_RETRIES times, after a timeout with the full AURORA_TIMEOUT_MS.
+//
+// A reply is timed by the poll that sees its first bytes, so loop stalls while it is in flight do not inflate the
+// estimate. A reply first seen after a poll gap over AURORA_POLL_GAP_US is not timed.
+class AuroraLink {
+    private:
+        struct Latency {
+            uint8_t op;
+            uint32_t srttUs;
+            uint32_t rttvarUs;
+        };
+        Stream *_serial;
+        uint8_t _txCtlPin;
+        uint8_t _tx[AURORA_REQUEST_SIZE];
+        uint8_t _rx[AURORA_REPLY_SIZE];
+        uint8_t _rxLen;
+        uint8_t _attempt;
+        bool _waiting;
+        bool _done;
+        bool _probe;
+        AuroraReply _reply;
+        unsigned long _startUs;
+        unsigned long _sentUs;
+        unsigned long _polledUs;
+        unsigned long _replyEndUs;
+        bool _replyTimed;
+        unsigned long _timeoutUs;
+        unsigned long _lastUs;
+        unsigned long _idleUs;
+        uint64_t _busyUs;
+        uint32_t _retries;
+        uint32_t _timeouts;
+        Latency _latency[AURORA_LINK_OPS];
+        uint8_t _latencyCount;
+        Latency *_findLatency(uint8_t op, bool create);
+        void _observe(uint8_t op, unsigned long us);
+        void _transmit();
+        void _receive();
+    public:
+        AuroraLink(Stream *serial, uint8_t txCtlPin);
+        void begin();
+        // Bus idle for at least AURORA_FRAME_GAP_US and no reply waiting to be collected
+        bool ready();
+        // A non-zero probeTimeoutUs replaces the adaptive timeout for probing, a timeout is then expected and neither
+        // retried nor counted
+        void send(uint8_t address, uint8_t op, const uint8_t *params, unsigned long probeTimeoutUs = 0);
+        // AURORA_PENDING until the reply arrives or times out, then fills reply and returns reply->result once
+        uint8_t poll(AuroraReply *reply);
+        // Send a request and wait for the reply. A request in flight from send() completes first, its reply is kept
+        // for poll(). Returns reply->result
+        uint8_t request(uint8_t address, uint8_t op, const uint8_t *params, AuroraReply *reply);
+        // Duration of the last completed exchange, first request to final reply or timeout. 0 when the final reply was
+        // collected too late to time
+        unsigned long lastUs();
+        // Total time the bus was occupied by exchanges
+        uint64_t busyUs();
+        // Current reply timeout for a command type
+        unsigned long timeoutUs(uint8_t op);
+        uint32_t retries();
+        uint32_t timeouts();
+};
+#endif    // AURORALINK_H
@@ -0,0 +1,76 @@
+#include "aurorascan.h"
+
+
+AuroraScan::AuroraScan(AuroraLink *link):
+    _link(link), _next(0), _running(false), _inFlight(false), _finished(false), _startUs(0), _durationUs(0),
+    _foundCount(0), _scans(0) {
+}
+
+bool AuroraScan::start() {
+    if (_running) {
+        return false;
+    }
+    _next = AURORA_SCAN_FIRST;
+    _foundCount = 0;
+    _inFlight = false;
+    _running = true;
+    _startUs = micros();
+    return true;
+}
+
+bool AuroraScan::loop() {
+    if (!_running) {
+        return false;
+    }
+    if (_inFlight) {
+        AuroraReply reply;
+        uint8_t result = _link->poll(&reply);
+        if (result == AURORA_PENDING) {
+            return false;
+        }
+        _inFlight = false;
+        if ((result == AURORA_OK || result == AURORA_REFUSED) && _foundCount < AURORA_SCAN_MAX) {
+            _found[_foundCount++] = _next;
+        }
+        if (++_next > AURORA_SCAN_LAST) {
+            _durationUs = micros() - _startUs;
+            _running = false;
+            _finished = true;
+            _scans++;
+            return false;
+        }
+    }
+    if (!_link->ready()) {
+        return false;
+    }
+    uint8_t params[6] = {0};
+    _link->send(_next, AURORA_OP_STATE, params, AURORA_SCAN_TIMEOUT_MS * 1000UL);
+    _inFlight = true;
+    return true;
+}
+
+bool AuroraScan::running() {
+    return _running;
+}
+
+bool AuroraScan::finished() {
+    bool finished = _finished;
+    _finished = false;
+    return finished;
+}
+
+const uint8_t *AuroraScan::addresses() {
+    return _found;
+}
+
+uint8_t AuroraScan::count() {
+    return _foundCount;
+}
+
+unsigned long AuroraScan::durationUs() {
+    return _durationUs;
+}
+
+uint32_t AuroraScan::scans() {
+    return _scans;
+}
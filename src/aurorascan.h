@@ -0,0 +1,54 @@
+#ifndef AURORASCAN_H
+#define AURORASCAN_H
+
+#include <Arduino.h>
+#include "auroralink.h"
+
+#ifndef AURORA_SCAN_FIRST
+#define AURORA_SCAN_FIRST 2 // Lowest inverter address, 0 is broadcast and 1 is reserved
+#endif
+
+#ifndef AURORA_SCAN_LAST
+#define AURORA_SCAN_LAST 63 // Highest inverter address
+#endif
+
+#ifndef AURORA_SCAN_TIMEOUT_MS
+#define AURORA_SCAN_TIMEOUT_MS 60 // Wait per address, well above the reply latency of a healthy inverter
+#endif
+
+#ifndef AURORA_SCAN_MAX
+#define AURORA_SCAN_MAX 8 // Responders kept
+#endif
+
+
+// Finds the inverters on the bus by sending a state request to every address with a short fixed timeout, without
+// blocking the loop. An address that answers, even with a refusal, is taken as present. The full range takes
+// about (AURORA_SCAN_TIMEOUT_MS + 7 ms) per address, around 4 s with the defaults.
+class AuroraScan {
+    private:
+        AuroraLink *_link;
+        uint8_t _next;
+        bool _running;
+        bool _inFlight;
+        bool _finished;
+        unsigned long _startUs;
+        unsigned long _durationUs;
+        uint8_t _found[AURORA_SCAN_MAX];
+        uint8_t _foundCount;
+        uint32_t _scans;
+    public:
+        AuroraScan(AuroraLink *link);
+        // Returns false if a scan is still running
+        bool start();
+        // Advance the scan, call often while running(). Returns true if it sent a request
+        bool loop();
+        bool running();
+        // True once after each scan ends
+        bool finished();
+        // Addresses that answered the last scan, in ascending order
+        const uint8_t *addresses();
+        uint8_t count();
+        unsigned long durationUs();
+        uint32_t scans();
+};
+#endif    // AURORASCAN_H
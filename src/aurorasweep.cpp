@@ -0,0 +1,114 @@
+#include "aurorasweep.h"
+
+
+AuroraSweep::AuroraSweep():
+    _link(NULL), _doneFunc(NULL), _address(0), _items(NULL), _count(0), _next(0), _running(false), _inFlight(false),
+    _finished(false), _online(false), _startUs(0), _durationUs(0), _sweeps(0), _aborted(0) {
+    memset(_replies, 0, sizeof(_replies));
+}
+
+void AuroraSweep::begin(AuroraLink *link, DoneFunc doneFunc, uint8_t address, const Item *items, uint8_t count) {
+    _link = link;
+    _doneFunc = doneFunc;
+    _address = address;
+    _items = items;
+    _count = min(count, (uint8_t)AURORA_SWEEP_MAX);
+}
+
+bool AuroraSweep::start() {
+    if (_running || _count == 0) {
+        return false;
+    }
+    _startUs = micros();
+    _next = 0;
+    _running = true;
+    _inFlight = false;
+    _online = false;
+    return true;
+}
+
+void AuroraSweep::_finish() {
+    _durationUs = micros() - _startUs;
+    _running = false;
+    _finished = true;
+    if (_online) {
+        _sweeps++;
+    } else {
+        _aborted++;
+        // Nothing from this sweep is valid
+        for (uint8_t i = 0; i < _count; i++) {
+            _replies[i].result = AURORA_TIMEOUT;
+        }
+    }
+}
+
+bool AuroraSweep::loop() {
+    if (!_running) {
+        return false;
+    }
+    if (_inFlight) {
+        uint8_t result = _link->poll(&_replies[_next]);
+        if (result == AURORA_PENDING) {
+            return false;
+        }
+        _inFlight = false;
+        if (_doneFunc) {
+            _doneFunc(_address, pgm_read_byte(&_items[_next].op), &_replies[_next], _link->lastUs());
+        }
+        if (_next == 0) {
+            _online = result != AURORA_TIMEOUT;
+        }
+        if (!_online || ++_next >= _count) {
+            _finish();
+            return false;
+        }
+    }
+    if (!_link->ready()) {
+        return false;
+    }
+    Item item;
+    memcpy_P(&item, &_items[_next], sizeof(item));
+    uint8_t params[6] = {item.param, item.param2};
+    _link->send(_address, item.op, params);
+    _inFlight = true;
+    return true;
+}
+
+bool AuroraSweep::running() {
+    return _running;
+}
+
+uint8_t AuroraSweep::address() {
+    return _address;
+}
+
+bool AuroraSweep::finished() {
+    bool finished = _finished;
+    _finished = false;
+    return finished;
+}
+
+bool AuroraSweep::online() {
+    return _online;
+}
+
+const AuroraReply *AuroraSweep::reply(uint8_t op, uint8_t param) {
+    for (uint8_t i = 0; i < _count; i++) {
+        if (pgm_read_byte(&_items[i].op) == op && pgm_read_byte(&_items[i].param) == param) {
+            return _replies[i].result == AURORA_OK ? &_replies[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+unsigned long AuroraSweep::durationUs() {
+    return _durationUs;
+}
+
+uint32_t AuroraSweep::sweeps() {
+    return _sweeps;
+}
+
+uint32_t AuroraSweep::aborted() {
+    return _aborted;
+}
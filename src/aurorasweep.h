@@ -0,0 +1,61 @@
+#ifndef AURORASWEEP_H
+#define AURORASWEEP_H
+
+#include <Arduino.h>
+#include "auroralink.h"
+
+#ifndef AURORA_SWEEP_MAX
+#define AURORA_SWEEP_MAX 24
+#endif
+
+
+// Polls a list of inverter requests back to back over an AuroraLink, without blocking the loop. Each request goes
+// out as soon as the bus has been idle for the inter-frame gap. A failed request is recorded and the sweep moves
+// on, except a timeout on the first item: that is taken as the inverter being offline and ends the sweep.
+class AuroraSweep {
+    public:
+        struct Item {
+            uint8_t op;
+            uint8_t param;
+            uint8_t param2;
+        };
+        // Called for every completed request, e.g. for metrics and logging. elapsedUs is AuroraLink::lastUs()
+        typedef void (*DoneFunc)(uint8_t address, uint8_t op, const AuroraReply *reply, unsigned long elapsedUs);
+    private:
+        AuroraLink *_link;
+        DoneFunc _doneFunc;
+        uint8_t _address;
+        const Item *_items;
+        uint8_t _count;
+        uint8_t _next;
+        bool _running;
+        bool _inFlight;
+        bool _finished;
+        bool _online;
+        AuroraReply _replies[AURORA_SWEEP_MAX];
+        unsigned long _startUs;
+        unsigned long _durationUs;
+        uint32_t _sweeps;
+        uint32_t _aborted;
+        void _finish();
+    public:
+        AuroraSweep();
+        // Item list in flash, at most AURORA_SWEEP_MAX. Put a state request first. Sweeps may share a link
+        void begin(AuroraLink *link, DoneFunc doneFunc, uint8_t address, const Item *items, uint8_t count);
+        // Returns false if a sweep is still running
+        bool start();
+        // Advance the sweep, call often. Returns true if it sent a request, so callers sharing a link can take turns
+        bool loop();
+        bool running();
+        uint8_t address();
+        // True once after each sweep ends
+        bool finished();
+        // Inverter answered the first request of the last sweep
+        bool online();
+        // Reply to op/param from the last sweep, NULL if that request failed
+        const AuroraReply *reply(uint8_t op, uint8_t param);
+        unsigned long durationUs();
+        uint32_t sweeps();
+        uint32_t aborted();
+};
+#endif    // AURORASWEEP_H
@@ -0,0 +1,92 @@
+#include "cbor.h"
+
+
+#define CBOR_MAJOR_UINT  0
+#define CBOR_MAJOR_TEXT  3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP   5
+#define CBOR_MAJOR_OTHER 7
+
+#define CBOR_FLOAT32 26
+#define CBOR_NULL    22
+
+
+CborWriter::CborWriter(uint8_t *buf, size_t size): _buf(buf), _size(size), _len(0), _overflow(false) {}
+
+void CborWriter::_put(uint8_t b) {
+    if (_len >= _size) {
+        _overflow = true;
+        return;
+    }
+    _buf[_len++] = b;
+}
+
+void CborWriter::_head(uint8_t major, uint32_t val) {
+    major <<= 5;
+    if (val < 24) {
+        _put(major | val);
+    } else if (val <= 0xff) {
+        _put(major | 24);
+        _put(val);
+    } else if (val <= 0xffff) {
+        _put(major | 25);
+        _put(val >> 8);
+        _put(val);
+    } else {
+        _put(major | 26);
+        _put(val >> 24);
+        _put(val >> 16);
+        _put(val >> 8);
+        _put(val);
+    }
+}
+
+void CborWriter::map(size_t count) {
+    _head(CBOR_MAJOR_MAP, count);
+}
+
+void CborWriter::array(size_t count) {
+    _head(CBOR_MAJOR_ARRAY, count);
+}
+
+void CborWriter::text(const char *s) {
+    size_t len = strlen(s);
+    _head(CBOR_MAJOR_TEXT, len);
+    for (size_t i = 0; i < len; i++) {
+        _put(s[i]);
+    }
+}
+
+void CborWriter::text_P(PGM_P s) {
+    size_t len = strlen_P(s);
+    _head(CBOR_MAJOR_TEXT, len);
+    for (size_t i = 0; i < len; i++) {
+        _put(pgm_read_byte(s + i));
+    }
+}
+
+void CborWriter::uint(uint32_t val) {
+    _head(CBOR_MAJOR_UINT, val);
+}
+
+void CborWriter::float32(float val) {
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    _put((CBOR_MAJOR_OTHER << 5) | CBOR_FLOAT32);
+    _put(bits >> 24);
+    _put(bits >> 16);
+    _put(bits >> 8);
+    _put(bits);
+}
+
+void CborWriter::null() {
+    _put((CBOR_MAJOR_OTHER << 5) | CBOR_NULL);
+}
+
+size_t CborWriter::length() {
+    return _len;
+}
+
+bool CborWriter::overflow() {
+    return _overflow;
+}
@@ -0,0 +1,27 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <Arduino.h>
+
+// Minimal CBOR (RFC 8949) writer into a caller provided buffer. Only the types needed for telemetry.
+class CborWriter {
+    private:
+        uint8_t *_buf;
+        size_t _size;
+        size_t _len;
+        bool _overflow;
+        void _put(uint8_t b);
+        void _head(uint8_t major, uint32_t val);
+    public:
+        CborWriter(uint8_t *buf, size_t size);
+        void map(size_t count);
+        void array(size_t count);
+        void text(const char *s);
+        void text_P(PGM_P s);
+        void uint(uint32_t val);
+        void float32(float val);
+        void null();
+        size_t length();
+        bool overflow();
+};
+#endif    // CBOR_H
@@ -0,0 +1,71 @@
+#include "clock.h"
+
+
+Clock::Clock(): _offsetUs(0), _slewUs(0), _lastTickUs(0), _epoch(0), _lastCorrectionUs(0), _syncs(0), _steps(0), _set(false) {}
+
+uint64_t Clock::monotonicUs() {
+    return micros64();
+}
+
+void Clock::sync(uint64_t epochUs) {
+    uint64_t mono = monotonicUs();
+    int64_t correction = (int64_t)(epochUs - (mono + _offsetUs + _slewUs));
+    _syncs++;
+    if (!_set || correction > CLOCK_STEP_US || correction < -CLOCK_STEP_US) {
+        _offsetUs = (int64_t)(epochUs - mono);
+        _slewUs = 0;
+        _steps++;
+        _set = true;
+    } else if (correction > CLOCK_DEADBAND_US || correction < -CLOCK_DEADBAND_US) {
+        // Correction is relative to the clock with any pending slew applied
+        _slewUs += correction;
+    }
+    _lastCorrectionUs = constrain(correction, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+    tick();
+}
+
+void Clock::tick() {
+    uint64_t mono = monotonicUs();
+    if (_slewUs != 0) {
+        int64_t maxAdjust = (int64_t)((mono - _lastTickUs) * CLOCK_SLEW_PPM / 1000000);
+        int64_t adjust = constrain(_slewUs, -maxAdjust, maxAdjust);
+        _offsetUs += adjust;
+        _slewUs -= adjust;
+    }
+    _lastTickUs = mono;
+    if (_set) {
+        unsigned long epoch = (mono + _offsetUs) / 1000000;
+        // A backward step holds the epoch until the new clock catches up
+        if (epoch > _epoch) {
+            _epoch = epoch;
+        }
+    }
+}
+
+bool Clock::isSet() {
+    return _set;
+}
+
+unsigned long Clock::epoch() {
+    return _epoch;
+}
+
+uint64_t Clock::nowUs() {
+    return monotonicUs() + _offsetUs;
+}
+
+int32_t Clock::lastCorrectionUs() {
+    return _lastCorrectionUs;
+}
+
+int32_t Clock::pendingSlewUs() {
+    return constrain(_slewUs, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+}
+
+uint32_t Clock::syncs() {
+    return _syncs;
+}
+
+uint32_t Clock::steps() {
+    return _steps;
+}
@@ -0,0 +1,50 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <Arduino.h>
+
+#ifndef CLOCK_STEP_US
+#define CLOCK_STEP_US 2000000 // Corrections larger than this step the clock, smaller ones are slewed
+#endif
+
+#ifndef CLOCK_DEADBAND_US
+#define CLOCK_DEADBAND_US 20000 // Corrections smaller than this are ignored as network jitter
+#endif
+
+#ifndef CLOCK_SLEW_PPM
+#define CLOCK_SLEW_PPM 5000 // Maximum slew rate, wall clock runs at most 0.5% fast or slow while slewing
+#endif
+
+
+// Wall clock disciplined from a time source, on top of the monotonic micros64() timebase.
+// wall = monotonic + offset. Small corrections are slewed into the offset gradually so the wall clock
+// never jumps, only large ones step it. epoch() is cached by tick() and never goes backwards.
+class Clock {
+    private:
+        int64_t _offsetUs;
+        int64_t _slewUs;
+        uint64_t _lastTickUs;
+        unsigned long _epoch;
+        int32_t _lastCorrectionUs;
+        uint32_t _syncs;
+        uint32_t _steps;
+        bool _set;
+    public:
+        Clock();
+        // Monotonic time since boot
+        uint64_t monotonicUs();
+        // Discipline to a reference wall clock time
+        void sync(uint64_t epochUs);
+        // Apply slew and cache the epoch. Call once per loop iteration
+        void tick();
+        bool isSet();
+        // Cached epoch seconds, 0 until first sync
+        unsigned long epoch();
+        // Current wall clock, not cached
+        uint64_t nowUs();
+        int32_t lastCorrectionUs();
+        int32_t pendingSlewUs();
+        uint32_t syncs();
+        uint32_t steps();
+};
+#endif    // CLOCK_H
@@ -0,0 +1,74 @@
+#include "dnscache.h"
+
+
+DnsCache::DnsCache(uint32_t ttlMs, uint32_t staleMs, uint32_t timeoutMs):
+    _count(0), _ttlMs(ttlMs), _staleMs(staleMs), _timeoutMs(timeoutMs), _results{0} {
+}
+
+DnsCache::Entry *DnsCache::_find(const char *host) {
+    for (uint8_t i = 0; i < _count; i++) {
+        if (strcmp(_entries[i].host, host) == 0) {
+            return &_entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Entries are only added after a successful lookup, so a name that never resolves does not hold a slot
+DnsCache::Entry *DnsCache::_add(const char *host) {
+    size_t len = strlen(host);
+    if (len >= DNS_HOST_MAX || _count == DNS_CACHE_SIZE) {
+        return NULL;
+    }
+    Entry *e = &_entries[_count++];
+    memcpy(e->host, host, len + 1);
+    return e;
+}
+
+uint8_t DnsCache::resolve(const char *host, IPAddress *ip) {
+    IPAddress literal;
+    if (literal.fromString(host)) {
+        *ip = literal;
+        _results[DNS_RESULT_LITERAL]++;
+        return DNS_RESULT_LITERAL;
+    }
+    Entry *e = _find(host);
+    uint32_t age = e ? millis() - e->resolvedMs : 0;
+    uint8_t result;
+    IPAddress resolved;
+    if (e && age < _ttlMs) {
+        *ip = IPAddress(e->ip);
+        result = DNS_RESULT_CACHED;
+    } else if (WiFi.hostByName(host, resolved, _timeoutMs) == 1 && resolved.isSet()) {
+        if (!e) {
+            // NULL when the cache is full or the name too long, the answer is then not kept
+            e = _add(host);
+        }
+        if (e) {
+            e->ip = resolved;
+            e->resolvedMs = millis();
+        }
+        *ip = resolved;
+        result = DNS_RESULT_RESOLVED;
+    } else if (e && age < _ttlMs + _staleMs) {
+        *ip = IPAddress(e->ip);
+        result = DNS_RESULT_STALE;
+    } else {
+        result = DNS_RESULT_FAILED;
+    }
+    _results[result]++;
+    return result;
+}
+
+void DnsCache::expire(const char *host) {
+    for (uint8_t i = 0; i < _count; i++) {
+        if (strcmp(_entries[i].host, host) == 0 && millis() - _entries[i].resolvedMs < _ttlMs) {
+            // Just past the TTL, the stale window still applies
+            _entries[i].resolvedMs = millis() - _ttlMs;
+        }
+    }
+}
+
+uint32_t DnsCache::results(uint8_t result) {
+    return _results[result];
+}
@@ -0,0 +1,51 @@
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#ifndef DNS_CACHE_SIZE
+#define DNS_CACHE_SIZE 6 // Destinations, one entry per host name: PVOutput, MQTT and up to SNTP_MAX_SERVERS NTP servers
+#endif
+
+#ifndef DNS_HOST_MAX
+#define DNS_HOST_MAX 64 // Longest cached host name including the terminator, longer names are looked up uncached
+#endif
+
+#define DNS_RESULT_FAILED 0
+#define DNS_RESULT_LITERAL 1 // Host is an IP address, no lookup
+#define DNS_RESULT_CACHED 2
+#define DNS_RESULT_RESOLVED 3
+#define DNS_RESULT_STALE 4 // Lookup failed, answer older than the TTL
+#define DNS_RESULT_COUNT 5
+
+
+// Host name answers kept for a fixed TTL, lwIP does not pass the record TTL up. When a lookup fails the last
+// answer is served for up to staleMs longer, so a flaky resolver does not take down a destination whose address
+// has not changed. Lookups are bounded by timeoutMs.
+class DnsCache {
+    private:
+        struct Entry {
+            char host[DNS_HOST_MAX];
+            uint32_t ip;
+            uint32_t resolvedMs;
+        };
+        Entry _entries[DNS_CACHE_SIZE];
+        uint8_t _count;
+        uint32_t _ttlMs;
+        uint32_t _staleMs;
+        uint32_t _timeoutMs;
+        uint32_t _results[DNS_RESULT_COUNT];
+        Entry *_find(const char *host);
+        Entry *_add(const char *host);
+    public:
+        DnsCache(uint32_t ttlMs, uint32_t staleMs, uint32_t timeoutMs);
+        // Sets ip and returns a DNS_RESULT_*, DNS_RESULT_FAILED leaves ip unchanged
+        uint8_t resolve(const char *host, IPAddress *ip);
+        // Look the host up again on next use, e.g. after a connect to the cached address failed. The old answer
+        // is still served as stale
+        void expire(const char *host);
+        // Lookups by DNS_RESULT_*
+        uint32_t results(uint8_t result);
+};
+#endif    // DNSCACHE_H
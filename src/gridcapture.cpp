@@ -0,0 +1,127 @@
+#include "gridcapture.h"
+
+
+GridCapture::GridCapture(float vLow, float vHigh, float fLow, float fHigh):
+    _head(0), _count(0), _remaining(0), _armed(true), _triggered(false), _cause(0), _triggerMs(0),
+    _vLow(vLow), _vHigh(vHigh), _fLow(fLow), _fHigh(fHigh), _samples(0), _events(0) {
+}
+
+uint8_t GridCapture::_check(const Sample *sample) {
+    uint8_t cause = 0;
+    if (sample->voltage < _vLow) {
+        cause |= GRID_CAUSE_UNDERVOLTAGE;
+    } else if (sample->voltage > _vHigh) {
+        cause |= GRID_CAUSE_OVERVOLTAGE;
+    }
+    if (sample->frequency < _fLow) {
+        cause |= GRID_CAUSE_UNDERFREQUENCY;
+    } else if (sample->frequency > _fHigh) {
+        cause |= GRID_CAUSE_OVERFREQUENCY;
+    }
+    return cause;
+}
+
+void GridCapture::add(uint32_t ms, float voltage, float frequency) {
+    if (ready()) {
+        return;
+    }
+    Sample *sample = &_ring[_head];
+    sample->ms = ms;
+    sample->voltage = voltage;
+    sample->frequency = frequency;
+    _head = (_head + 1) % GRID_CAPTURE_SAMPLES;
+    if (_count < GRID_CAPTURE_SAMPLES) {
+        _count++;
+    }
+    _samples++;
+
+    // NaN compares false, a failed reading neither triggers nor rearms
+    uint8_t cause = _check(sample);
+    if (_triggered) {
+        _cause |= cause;
+        _remaining--;
+        return;
+    }
+    if (cause == 0) {
+        if (!isnan(voltage) && !isnan(frequency)) {
+            _armed = true;
+        }
+        return;
+    }
+    if (!_armed) {
+        return;
+    }
+    _triggered = true;
+    _armed = false;
+    _cause = cause;
+    _triggerMs = ms;
+    _remaining = GRID_CAPTURE_SAMPLES - GRID_CAPTURE_PRE - 1;
+    _events++;
+}
+
+bool GridCapture::ready() {
+    return _triggered && _remaining == 0;
+}
+
+void GridCapture::rearm() {
+    _triggered = false;
+    _count = 0;
+}
+
+size_t GridCapture::encode(uint8_t *buf, size_t bufLen, uint8_t address, unsigned long epoch) {
+    uint8_t first = (_head + GRID_CAPTURE_SAMPLES - _count) % GRID_CAPTURE_SAMPLES;
+    // Everything after the trigger sample is post-trigger
+    uint8_t trigger = _count - (GRID_CAPTURE_SAMPLES - GRID_CAPTURE_PRE);
+    CborWriter cbor(buf, bufLen);
+    cbor.map(7);
+    cbor.text_P(PSTR("address"));
+    cbor.uint(address);
+    cbor.text_P(PSTR("time"));
+    cbor.uint(epoch);
+    cbor.text_P(PSTR("cause"));
+    cbor.uint(_cause);
+    cbor.text_P(PSTR("ms"));
+    cbor.array(_count);
+    for (uint8_t i = 0; i < _count; i++) {
+        cbor.uint(_ring[(first + i) % GRID_CAPTURE_SAMPLES].ms - _ring[first].ms);
+    }
+    cbor.text_P(PSTR("trigger"));
+    cbor.uint(trigger);
+    cbor.text_P(PSTR("voltage_dv"));
+    cbor.array(_count);
+    for (uint8_t i = 0; i < _count; i++) {
+        float voltage = _ring[(first + i) % GRID_CAPTURE_SAMPLES].voltage;
+        if (isnan(voltage) || voltage < 0) {
+            cbor.null();
+        } else {
+            cbor.uint(lroundf(voltage * 10));
+        }
+    }
+    cbor.text_P(PSTR("frequency_chz"));
+    cbor.array(_count);
+    for (uint8_t i = 0; i < _count; i++) {
+        float frequency = _ring[(first + i) % GRID_CAPTURE_SAMPLES].frequency;
+        if (isnan(frequency) || frequency < 0) {
+            cbor.null();
+        } else {
+            cbor.uint(lroundf(frequency * 100));
+        }
+    }
+    return cbor.overflow() ? 0 : cbor.length();
+}
+
+uint8_t GridCapture::cause() {
+    return _cause;
+}
+
+uint32_t GridCapture::triggerMs() {
+    return _triggerMs;
+}
+
+uint32_t GridCapture::samples() {
+    return _samples;
+}
+
+uint32_t GridCapture::events() {
+    return _events;
+}
@@ -0,0 +1,68 @@
+#ifndef GRIDCAPTURE_H
+#define GRIDCAPTURE_H
+
+#include <Arduino.h>
+#include "cbor.h"
+
+#ifndef GRID_CAPTURE_SAMPLES
+#define GRID_CAPTURE_SAMPLES 48 // Samples in a captured window
+#endif
+
+#ifndef GRID_CAPTURE_PRE
+#define GRID_CAPTURE_PRE 16 // Samples before the trigger kept in the window
+#endif
+
+static_assert(GRID_CAPTURE_PRE < GRID_CAPTURE_SAMPLES && GRID_CAPTURE_SAMPLES <= 255, "GRID_CAPTURE_PRE must leave room for the trigger");
+
+#define GRID_CAUSE_UNDERVOLTAGE   0x01
+#define GRID_CAUSE_OVERVOLTAGE    0x02
+#define GRID_CAUSE_UNDERFREQUENCY 0x04
+#define GRID_CAUSE_OVERFREQUENCY  0x08
+
+
+// Keeps the latest grid voltage and frequency samples in a ring. A sample outside the limits triggers a capture:
+// the ring fills up with GRID_CAPTURE_SAMPLES - GRID_CAPTURE_PRE more samples and is then frozen until the window
+// has been encoded and rearm() is called. A new capture needs a sample back inside the limits first, so a
+// sustained excursion is recorded once.
+class GridCapture {
+    public:
+        struct Sample {
+            uint32_t ms;
+            float voltage;
+            float frequency;
+        };
+    private:
+        Sample _ring[GRID_CAPTURE_SAMPLES];
+        uint8_t _head;
+        uint8_t _count;
+        uint8_t _remaining;
+        bool _armed;
+        bool _triggered;
+        uint8_t _cause;
+        uint32_t _triggerMs;
+        float _vLow;
+        float _vHigh;
+        float _fLow;
+        float _fHigh;
+        uint32_t _samples;
+        uint32_t _events;
+        uint8_t _check(const Sample *sample);
+    public:
+        GridCapture(float vLow, float vHigh, float fLow, float fHigh);
+        // Failed readings are NaN, they never trigger
+        void add(uint32_t ms, float voltage, float frequency);
+        // A window is complete and waits to be encoded
+        bool ready();
+        // Drop the window and watch for the next event
+        void rearm();
+        // Encode the window as a CBOR map: address, time (epoch of the trigger), cause (GRID_CAUSE_* bits seen in the
+        // window), trigger (index of the trigger sample), ms (offsets from the first sample), voltage_dv (0.1 V) and
+        // frequency_chz (0.01 Hz), null for failed readings. Returns encoded length, or 0 if buf is too small.
+        size_t encode(uint8_t *buf, size_t bufLen, uint8_t address, unsigned long epoch);
+        uint8_t cause();
+        // millis() of the trigger sample
+        uint32_t triggerMs();
+        uint32_t samples();
+        uint32_t events();
+};
+#endif    // GRIDCAPTURE_H
@@ -0,0 +1,71 @@
+#include "inverterclock.h"
+
+
+InverterClock::InverterClock(): _baseEpoch(0), _baseOffset(0), _refEpoch(0), _refOffset(0), _driftPpm(0), _lastRead(0), _valid(false), _driftValid(false) {}
+
+void InverterClock::sample(unsigned long epoch, long offset) {
+    _lastRead = epoch;
+    _refEpoch = epoch;
+    _refOffset = offset;
+    if (!_valid) {
+        _baseEpoch = epoch;
+        _baseOffset = offset;
+        _valid = true;
+        return;
+    }
+    unsigned long dt = epoch - _baseEpoch;
+    if (dt < INVERTER_CLOCK_MIN_BASELINE) {
+        // Too short a baseline for the 1 s resolution, keep the previous drift
+        return;
+    }
+    _driftPpm = (offset - _baseOffset) * 1e6 / dt;
+    _driftValid = true;
+}
+
+void InverterClock::written(unsigned long epoch) {
+    // The offset steps, start a new baseline but keep predicting with the previous drift
+    _baseEpoch = epoch;
+    _baseOffset = 0;
+    _refEpoch = epoch;
+    _refOffset = 0;
+    _lastRead = epoch;
+    _valid = true;
+}
+
+void InverterClock::stepped(float seconds) {
+    long epochShift = lroundf(seconds);
+    _baseEpoch += epochShift;
+    _baseOffset -= seconds;
+    _refEpoch += epochShift;
+    _refOffset -= seconds;
+    _lastRead += epochShift;
+}
+
+float InverterClock::predict(unsigned long epoch) {
+    if (!_valid) {
+        return 0;
+    }
+    return _refOffset + _driftPpm * (long)(epoch - _refEpoch) / 1e6;
+}
+
+bool InverterClock::readDue(unsigned long epoch, unsigned long readPeriod, float maxError) {
+    if (!_valid) {
+        return true;
+    }
+    if (epoch - _lastRead >= readPeriod) {
+        return true;
+    }
+    return fabs(predict(epoch)) >= maxError;
+}
+
+bool InverterClock::valid() {
+    return _valid;
+}
+
+bool InverterClock::driftValid() {
+    return _driftValid;
+}
+
+float InverterClock::driftPpm() {
+    return _driftPpm;
+}
@@ -0,0 +1,41 @@
+#ifndef INVERTERCLOCK_H
+#define INVERTERCLOCK_H
+
+#include <Arduino.h>
+
+#ifndef INVERTER_CLOCK_MIN_BASELINE
+#define INVERTER_CLOCK_MIN_BASELINE 1800 // Minimum seconds from the base sample for a drift estimate, the inverter clock has 1 s resolution
+#endif
+
+
+// Model of the inverter clock offset from the wall clock: offset at the last sample plus a drift rate.
+// The drift is measured from a base sample kept until the inverter clock is written, so the 1 s
+// resolution error shrinks as the baseline grows.
+// Predicts the inverter clock error so it is only read and written when needed.
+class InverterClock {
+    private:
+        unsigned long _baseEpoch;
+        float _baseOffset;
+        unsigned long _refEpoch;
+        float _refOffset;
+        float _driftPpm;
+        unsigned long _lastRead;
+        bool _valid;
+        bool _driftValid;
+    public:
+        InverterClock();
+        // Inverter clock minus wall clock in seconds, measured at epoch
+        void sample(unsigned long epoch, long offset);
+        // Inverter clock was set to the wall clock at epoch
+        void written(unsigned long epoch);
+        // Wall clock stepped forward by seconds, negative for back. Re-expresses the samples against the new wall clock
+        void stepped(float seconds);
+        // Predicted inverter clock error at epoch, seconds
+        float predict(unsigned long epoch);
+        // Whether the inverter clock should be read: no model yet, readPeriod elapsed or predicted error over maxError
+        bool readDue(unsigned long epoch, unsigned long readPeriod, float maxError);
+        bool valid();
+        bool driftValid();
+        float driftPpm();
+};
+#endif    // INVERTERCLOCK_H
@@ -0,0 +1,125 @@
+#include "logger.h"
+
+
+#define LOG_RING_MASK (LOG_RECORD_COUNT - 1)
+
+static_assert((LOG_RECORD_COUNT & LOG_RING_MASK) == 0, "LOG_RECORD_COUNT must be a power of 2");
+
+
+LogRing::LogRing(): _head(0), _tail(0), _serialTail(0), _publishTail(0), _dropped(0), _droppedReported(0) {}
+
+void LogRing::vprintf_P(uint8_t sinks, PGM_P fmt, va_list args) {
+    uint16_t head = _head;
+    if ((uint16_t)(head - _tail) >= LOG_RECORD_COUNT) {
+        _dropped++;
+        return;
+    }
+    Record *rec = &_records[head & LOG_RING_MASK];
+    int len = vsnprintf_P(rec->msg, sizeof(rec->msg), fmt, args);
+    if (len < 0) {
+        len = 0;
+    } else if (len >= (int)sizeof(rec->msg)) {
+        // Mark truncation
+        len = sizeof(rec->msg) - 1;
+        memcpy(&rec->msg[len - 4], "...\n", 4);
+    }
+    rec->len = len;
+    rec->pos = 0;
+    rec->sinks = sinks;
+    // Publish record to consumer
+    _head = head + 1;
+}
+
+void LogRing::printf_P(uint8_t sinks, PGM_P fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf_P(sinks, fmt, args);
+    va_end(args);
+}
+
+// Release records every sink they are for has passed, carrying along the cursor of a sink they are not for.
+// Sink cursors never fall behind _tail
+void LogRing::_free() {
+    uint16_t tail = _tail;
+    while (tail != _head) {
+        uint8_t sinks = _records[tail & LOG_RING_MASK].sinks;
+        if (((sinks & LOG_SINK_SERIAL) && _serialTail == tail) || ((sinks & LOG_SINK_MQTT) && _publishTail == tail)) {
+            break;
+        }
+        if (_serialTail == tail) {
+            _serialTail++;
+        }
+        if (_publishTail == tail) {
+            _publishTail++;
+        }
+        tail++;
+    }
+    _tail = tail;
+}
+
+uint16_t LogRing::drainSerial(Print *serial) {
+    uint16_t done = 0;
+    while (_serialTail != _head) {
+        Record *rec = &_records[_serialTail & LOG_RING_MASK];
+        if (serial && (rec->sinks & LOG_SINK_SERIAL)) {
+            int room = serial->availableForWrite();
+            if (room <= 0) {
+                break;
+            }
+            size_t n = min((size_t)room, (size_t)(rec->len - rec->pos));
+            serial->write((const uint8_t *)&rec->msg[rec->pos], n);
+            rec->pos += n;
+            if (rec->pos < rec->len) {
+                break;
+            }
+            done++;
+        }
+        _serialTail++;
+    }
+    _free();
+    uint32_t dropped = _dropped;
+    if (serial && dropped != _droppedReported && serial->availableForWrite() >= 40) {
+        serial->printf_P(PSTR("Log: %lu messages dropped\n"), (unsigned long)(dropped - _droppedReported));
+        _droppedReported = dropped;
+    }
+    return done;
+}
+
+uint16_t LogRing::drainPublish(PublishFunc publish, uint16_t maxRecords) {
+    uint16_t done = 0;
+    while (_publishTail != _head) {
+        Record *rec = &_records[_publishTail & LOG_RING_MASK];
+        if (rec->sinks & LOG_SINK_MQTT) {
+            if (done == maxRecords) {
+                break;
+            }
+            // MQTT messages are published whole, or discarded if there is no connection
+            if (publish) {
+                publish(rec->msg);
+            }
+            done++;
+        }
+        _publishTail++;
+    }
+    _free();
+    return done;
+}
+
+uint16_t LogRing::pending() {
+    return _head - _tail;
+}
+
+uint16_t LogRing::pending(uint8_t sink) {
+    uint16_t tail = sink == LOG_SINK_SERIAL ? _serialTail : _publishTail;
+    uint16_t count = 0;
+    for (uint16_t i = tail; i != _head; i++) {
+        if (_records[i & LOG_RING_MASK].sinks & sink) {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint32_t LogRing::dropped() {
+    return _dropped;
+}
@@ -0,0 +1,69 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#ifdef DEBUG
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+#ifndef LOG_RECORD_SIZE
+#define LOG_RECORD_SIZE 160 // Longer messages are truncated
+#endif
+
+#ifndef LOG_RECORD_COUNT
+#define LOG_RECORD_COUNT 16 // Must be a power of 2
+#endif
+
+#define LOG_SINK_SERIAL 0x01
+#define LOG_SINK_MQTT   0x02
+
+
+// Single producer, single consumer ring of preformatted log records.
+// Producers format into a free record and never block; when the ring is full the message is dropped and counted.
+// Each sink drains at its own pace, only as far as it can take without blocking. A record is freed once every sink
+// has passed it.
+class LogRing {
+    public:
+        typedef bool (*PublishFunc)(const char *msg);
+    private:
+        struct Record {
+            uint8_t sinks;
+            uint16_t len;
+            uint16_t pos;
+            char msg[LOG_RECORD_SIZE];
+        };
+        Record _records[LOG_RECORD_COUNT];
+        volatile uint16_t _head;
+        volatile uint16_t _tail;
+        uint16_t _serialTail;
+        uint16_t _publishTail;
+        volatile uint32_t _dropped;
+        uint32_t _droppedReported;
+        void _free();
+    public:
+        LogRing();
+        // Format strings are in flash (PSTR)
+        void vprintf_P(uint8_t sinks, PGM_P fmt, va_list args);
+        void printf_P(uint8_t sinks, PGM_P fmt, ...);
+        // Returns the records written out. NULL serial discards LOG_SINK_SERIAL records
+        uint16_t drainSerial(Print *serial);
+        // Returns the records published, at most maxRecords. Records are discarded if publish fails
+        uint16_t drainPublish(PublishFunc publish, uint16_t maxRecords = 0xffff);
+        // Records not yet freed
+        uint16_t pending();
+        // Records waiting for the sink
+        uint16_t pending(uint8_t sink);
+        uint32_t dropped();
+};
+#endif    // LOGGER_H
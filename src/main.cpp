@@ -10,49 +10,601 @@
 #include <WiFiClient.h>
 #include <ESP8266WiFi.h>
 #include <ESP8266WebServer.h>
+#include <uri/UriBraces.h>
 #include <ESP8266HTTPClient.h>
-#include <SoftwareSerial.h>
-#include <NTPClient.h>
 #include <WiFiUdp.h>
 #include <PubSubClient.h>
-#include <Aurora.h>
+#include <SoftwareSerial.h>
 #include <TimeLib.h>
+#include <EEPROM.h>
 
 #include "led.h"
+#include "cbor.h"
+#include "logger.h"
+#include "metrics.h"
+#include "stall.h"
+#include "recorder.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "timesync.h"
+#include "inverterclock.h"
+#include "rtcmem.h"
+#include "auroraframe.h"
+#include "auroralink.h"
+#include "aurorasweep.h"
+#include "aurorascan.h"
+#include "gridcapture.h"
+#include "powerwindow.h"
+#include "solar.h"
+#include "powersave.h"
+#include "pvbacklog.h"
+#include "dnscache.h"
+#include "netscheduler.h"
 
 
 #ifndef NTP_OFFSET
 #define NTP_OFFSET 0
 #endif
 
+#ifndef NTP_SERVER_1
+#define NTP_SERVER_1 "0.pool.ntp.org"
+#endif
+
+#ifndef NTP_SERVER_2
+#define NTP_SERVER_2 "1.pool.ntp.org"
+#endif
+
+#ifndef NTP_SERVER_3
+#define NTP_SERVER_3 "2.pool.ntp.org"
+#endif
+
+#ifndef NTP_UPDATE_INTERVAL
+#define NTP_UPDATE_INTERVAL 300 // Seconds between NTP updates
+#endif
+
 #ifndef UPDATE_PERIOD_PVOUTPUT
 #define UPDATE_PERIOD_PVOUTPUT 300 // Update PV Output every 5 minutes
 #endif
 
+#ifndef PVOUTPUT_BATCH_MAX
+#define PVOUTPUT_BATCH_MAX 20 // Backlog readings per addbatchstatus request, PVOutput accepts up to 30
+#endif
+
 #ifndef UPDATE_PERIOD_STATS
 #define UPDATE_PERIOD_STATS  30  // Update stats every 30 seconds
 #endif
 
+#ifndef UPDATE_PERIOD_DAWN
+#define UPDATE_PERIOD_DAWN 60 // Stats period around dawn until an inverter answers
+#endif
+
+#ifndef UPDATE_PERIOD_NIGHT
+#define UPDATE_PERIOD_NIGHT 1800 // Stats period at night while no inverter answers
+#endif
+
+#ifndef SOLAR_LATITUDE
+#define SOLAR_LATITUDE NAN // Degrees north. Set with SOLAR_LONGITUDE to poll by the sun, NAN polls at full rate all night
+#endif
+
+#ifndef SOLAR_LONGITUDE
+#define SOLAR_LONGITUDE NAN // Degrees east
+#endif
+
+#ifndef SOLAR_DAWN_LEAD
+#define SOLAR_DAWN_LEAD 2700 // Seconds before sunrise to start probing at UPDATE_PERIOD_DAWN
+#endif
+
+#ifndef SOLAR_DUSK_MARGIN
+#define SOLAR_DUSK_MARGIN 1800 // Seconds after sunset still polled at full rate
+#endif
+
+static_assert(SOLAR_DAWN_LEAD > UPDATE_PERIOD_NIGHT, "The last night probe must fall before sunrise");
+
+#ifndef POWER_SAVE
+#define POWER_SAVE POWER_SAVE_MODEM // POWER_SAVE_OFF, POWER_SAVE_MODEM or POWER_SAVE_LIGHT
+#endif
+
+#ifndef POWER_LISTEN_INTERVAL
+#define POWER_LISTEN_INTERVAL 3 // Wake for every 3rd DTIM beacon while asleep, about 300 ms at DTIM 1
+#endif
+
+#ifndef POWER_IDLE_MAX_MS
+#define POWER_IDLE_MAX_MS 50 // Longest single idle, bounds the extra latency for the web server, LED and SNTP
+#endif
+
+#ifndef STATE_FLASH_PERIOD
+#define STATE_FLASH_PERIOD 21600 // Seconds between state copies to flash. Each write erases a sector, keep it rare
+#endif
+
+#ifndef STALL_THRESHOLD_MS
+#define STALL_THRESHOLD_MS 2000 // Record loop iterations taking longer than this
+#endif
+
+#ifndef FLIGHT_RECORDER_HEAP_STEP
+#define FLIGHT_RECORDER_HEAP_STEP 512 // Record a new heap low-water mark once it drops by this many bytes
+#endif
+
+#ifndef MEMORY_FREE_HEAP_WARN
+#define MEMORY_FREE_HEAP_WARN 16384 // Warn at boot if free heap is below this, to catch static DRAM regressions
+#endif
+
+#ifndef FAST_BOOT
+#define FAST_BOOT 1 // After a warm reset skip boot delays and reconnect WiFi with the association cached in RTC memory
+#endif
+
+#ifndef WIFI_CACHE_TIMEOUT_MS
+#define WIFI_CACHE_TIMEOUT_MS 5000 // Fall back to a full scan and DHCP if the cached association has not connected
+#endif
+
+#ifndef MQTT_RETRY_PERIOD
+#define MQTT_RETRY_PERIOD 60 // Seconds between MQTT connection attempts
+#endif
+
+#ifndef DNS_CACHE_TTL
+#define DNS_CACHE_TTL 300 // Seconds a host name answer is used before looking it up again
+#endif
+
+#ifndef DNS_CACHE_STALE
+#define DNS_CACHE_STALE 86400 // Seconds an expired answer is still used while lookups fail
+#endif
+
+#ifndef DNS_TIMEOUT_MS
+#define DNS_TIMEOUT_MS 2000 // Longest wait for one host name lookup
+#endif
+
+#ifndef NET_CONNECT_TIMEOUT_MS
+#define NET_CONNECT_TIMEOUT_MS 5000 // TCP connect, and TLS handshake for PVOutput
+#endif
+
+#ifndef NET_READ_TIMEOUT_MS
+#define NET_READ_TIMEOUT_MS 5000 // Longest wait for a reply on an open connection
+#endif
+
+#ifndef NET_TICK_BUDGET_US
+#define NET_TICK_BUDGET_US 50000 // Network time per loop tick after which only the web server and MQTT keepalive run
+#endif
+
+#ifndef NET_BUDGET_PUBLISH_US
+#define NET_BUDGET_PUBLISH_US 20000 // Per tick budget for MQTT status, power and grid event publishes
+#endif
+
+#ifndef NET_BUDGET_PVOUTPUT_US
+#define NET_BUDGET_PVOUTPUT_US 20000 // Per tick budget for live PVOutput uploads. Refused readings go to the backlog
+#endif
+
+#ifndef NET_BUDGET_LOG_US
+#define NET_BUDGET_LOG_US 5000 // Per tick budget for log records published on MQTT
+#endif
+
+#ifndef NET_BUDGET_BULK_US
+#define NET_BUDGET_BULK_US 10000 // Per tick budget for backlog replay and the flight recorder dump
+#endif
+
+#ifndef PVOUTPUT_REPLAY_RETRY
+#define PVOUTPUT_REPLAY_RETRY 60 // Seconds before replaying the backlog again after a failed batch
+#endif
+
+#ifndef PVOUTPUT_KEEPALIVE_MS
+#define PVOUTPUT_KEEPALIVE_MS 30000 // Reuse the PVOutput connection if idle for less. Servers drop idle ones soon after
+#endif
+
+#ifndef INVERTER_CLOCK_MAX_ERROR
+#define INVERTER_CLOCK_MAX_ERROR 2 // Seconds of inverter clock error before it is rewritten
+#endif
+
+#ifndef INVERTER_CLOCK_READ_PERIOD
+#define INVERTER_CLOCK_READ_PERIOD 3600 // Seconds between inverter clock reads while the predicted error is small
+#endif
+
+#ifndef INVERTER_ADDRESSES
+#define INVERTER_ADDRESSES {INVERTER_ADDRESS} // RS485 addresses of all inverters on the bus, e.g. {2, 3}
+#endif
+
+#ifndef PVOUTPUT_API_SIDS
+#define PVOUTPUT_API_SIDS {PVOUTPUT_API_SID} // PVOutput system ID per inverter, in INVERTER_ADDRESSES order
+#endif
+
+#ifndef INVERTER_MAX
+#define INVERTER_MAX 8 // Inverters polled at most, configured or found by a bus scan
+#endif
+
+#ifndef INVERTER_SCAN_BOOT
+#define INVERTER_SCAN_BOOT 0 // Scan the bus after the first sample and poll the inverters that answer
+#endif
+
+#ifndef AURORA_HW_SERIAL
+#define AURORA_HW_SERIAL 0 // Run the inverter link on UART0, swapped to GPIO13 (RX) / GPIO15 (TX), instead of SoftwareSerial
+#endif
+
+#ifndef LOG_SERIAL1
+#define LOG_SERIAL1 0 // With AURORA_HW_SERIAL, log to Serial1 (TX only, GPIO2) rather than to MQTT. Needs PIN_LED moved off GPIO2
+#endif
+
+#ifndef PIN_LED
+#define PIN_LED LED_BUILTIN
+#endif
+
+#ifndef MQTT_STAT_CBOR
+#define MQTT_STAT_CBOR 1 // Compile in CBOR encoded status, published on tele/<topic>/STATCBOR
+#endif
+
+#ifndef MQTT_STAT_CBOR_ENABLED
+#define MQTT_STAT_CBOR_ENABLED false // Publish CBOR status from boot. Toggled at runtime by cmnd/<topic>/STATCBOR ON|OFF
+#endif
+
+#ifndef GRID_CAPTURE
+#define GRID_CAPTURE 1 // Sample the grid on the idle bus and publish excursions on tele/<topic>/GRIDEVENT as CBOR
+#endif
+
+#ifndef GRID_VOLTAGE_LOW
+#define GRID_VOLTAGE_LOW 207.0 // Volts, EN 50160 nominal 230 V - 10%
+#endif
+
+#ifndef GRID_VOLTAGE_HIGH
+#define GRID_VOLTAGE_HIGH 253.0 // Volts, 230 V + 10%
+#endif
+
+#ifndef GRID_FREQUENCY_LOW
+#define GRID_FREQUENCY_LOW 49.5 // Hz, 50 Hz - 1%
+#endif
+
+#ifndef GRID_FREQUENCY_HIGH
+#define GRID_FREQUENCY_HIGH 50.5 // Hz, 50 Hz + 1%
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Metrics. Updated on the hot path, formatted only when /metrics is scraped
+
+#define AURORA_CMD_STATE            0
+#define AURORA_CMD_DSP              1
+#define AURORA_CMD_CUMULATED_ENERGY 2
+#define AURORA_CMD_TIME_READ        3
+#define AURORA_CMD_TIME_WRITE       4
+#define AURORA_CMD_COUNT            5
+
+#define LOOP_HANDLER_LOG  0
+#define LOOP_HANDLER_MQTT 1
+#define LOOP_HANDLER_NTP  2
+#define LOOP_HANDLER_WEB  3
+#define LOOP_HANDLER_LED  4
+#define LOOP_HANDLER_INVERTER 5
+#define LOOP_HANDLER_COUNT 6
+
+Histogram metricsAuroraLatency[AURORA_CMD_COUNT];
+uint32_t  metricsAuroraFailures[AURORA_CMD_COUNT] = {0};
+uint32_t  metricsAuroraResults[AURORA_RESULT_COUNT] = {0};
+Histogram metricsLoop;
+Histogram metricsLoopHandler[LOOP_HANDLER_COUNT];
+Histogram metricsPvOutputUpload;
+Histogram metricsAuroraSweep;
+#define NET_DEST_PVOUTPUT 0
+#define NET_DEST_MQTT     1
+#define NET_DEST_COUNT    2
+
+Histogram metricsNetConnect[NET_DEST_COUNT];
+uint32_t  metricsNetConnectFailed[NET_DEST_COUNT] = {0};
+uint32_t  metricsPvOutputReused = 0;
+uint32_t  metricsPvOutputOk = 0;
+uint32_t  metricsPvOutputFailed = 0;
+uint32_t  metricsMqttPublishOk = 0;
+uint32_t  metricsMqttPublishFailed = 0;
+
+
+// Crash flight recorder, recovered from RTC memory at boot
+FlightRecorder flightRecorder;
+
+
+void auroraRequestObserve(uint8_t cmd, unsigned long elapsed, uint8_t result) {
+    if (elapsed > 0) {
+        // 0 when the reply was collected too late to time
+        metricsAuroraLatency[cmd].observe(elapsed);
+    }
+    metricsAuroraResults[result]++;
+    if (result != AURORA_OK) {
+        metricsAuroraFailures[cmd]++;
+        // Successes would overwrite the recorder within seconds during grid burst sampling
+        flightRecorder.record(FR_EVENT_AURORA, cmd | result << 4, min(elapsed / 1000, 0xffffUL));
+    }
+}
+
+
+void auroraRequestDone(uint8_t cmd, unsigned long tStartUs, uint8_t result) {
+    auroraRequestObserve(cmd, micros() - tStartUs, result);
+}
+
+
+// Metrics index of a protocol command
+uint8_t auroraCmd(uint8_t op) {
+    switch (op) {
+        case AURORA_OP_DSP:        return AURORA_CMD_DSP;
+        case AURORA_OP_CUMULATED:  return AURORA_CMD_CUMULATED_ENERGY;
+        case AURORA_OP_TIME_READ:  return AURORA_CMD_TIME_READ;
+        case AURORA_OP_TIME_WRITE: return AURORA_CMD_TIME_WRITE;
+    }
+    return AURORA_CMD_STATE;
+}
+
+
+bool metricsMqttPublish(bool ok) {
+    if (ok) {
+        metricsMqttPublishOk++;
+    } else {
+        metricsMqttPublishFailed++;
+    }
+    return ok;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Loop stall detection
+
+StallDetector stallDetector(STALL_THRESHOLD_MS);
+
+
+// Switch loop stage, returns the previous stage. The stage is also kept in the flight recorder
+uint8_t loopStageEnter(uint8_t stage) {
+    flightRecorder.stage(stage);
+    return stallDetector.enter(stage);
+}
+
+
+// Mark the active loop stage for the lifetime of the object
+class LoopStage {
+    private:
+        uint8_t _previous;
+    public:
+        LoopStage(uint8_t stage): _previous(loopStageEnter(stage)) {}
+        ~LoopStage() {
+            loopStageEnter(_previous);
+        }
+};
+
+
+DnsCache dnsCache(DNS_CACHE_TTL * 1000UL, DNS_CACHE_STALE * 1000UL, DNS_TIMEOUT_MS);
+
+
+bool netResolve(const char *host, IPAddress *ip, bool allowStale);
+
+
+// NTP servers through dnsCache like every other destination. A stale address is fine, the reply is checked
+bool sntpResolve(const char *host, IPAddress *ip) {
+    return netResolve(host, ip, true);
+}
+
+
+void netConnectDone(uint8_t dest, int connected, unsigned long tStartUs) {
+    metricsNetConnect[dest].observeSince(tStartUs);
+    if (!connected) {
+        metricsNetConnectFailed[dest]++;
+    }
+}
+
+
+// MQTT client. Connects to the cached address, stale if need be, with bounded connect and read timeouts
+class NetWiFiClient: public WiFiClient {
+    public:
+        int connect(const char *name, uint16_t port) override {
+            IPAddress ip;
+            if (!netResolve(name, &ip, true)) {
+                return 0;
+            }
+            int ret = connect(ip, port);
+            if (!ret) {
+                // The address may have moved, look it up again next time
+                dnsCache.expire(name);
+            }
+            return ret;
+        }
+        int connect(IPAddress ip, uint16_t port) override {
+            setTimeout(NET_CONNECT_TIMEOUT_MS);
+            unsigned long tStart = micros();
+            int ret = WiFiClient::connect(ip, port);
+            netConnectDone(NET_DEST_MQTT, ret, tStart);
+            setTimeout(NET_READ_TIMEOUT_MS);
+            return ret;
+        }
+};
+
+
+// PVOutput client timing TCP connect and TLS handshake. TLS needs the name for SNI so the connection is made by
+// name, lwIP answers that lookup from the one just done through dnsCache. A stale answer cannot be passed on, so a
+// failed lookup fails the connect at once rather than after BearSSL's own lookup times out
+class TimedWiFiClientSecure: public BearSSL::WiFiClientSecure {
+    public:
+        int connect(const char *name, uint16_t port) override {
+            IPAddress ip;
+            if (!netResolve(name, &ip, false)) {
+                metricsNetConnectFailed[NET_DEST_PVOUTPUT]++;
+                return 0;
+            }
+            LoopStage stage(STAGE_PVOUTPUT_CONNECT);
+            setTimeout(NET_CONNECT_TIMEOUT_MS);
+            unsigned long tStart = micros();
+            int ret = BearSSL::WiFiClientSecure::connect(name, port);
+            netConnectDone(NET_DEST_PVOUTPUT, ret, tStart);
+            setTimeout(NET_READ_TIMEOUT_MS);
+            return ret;
+        }
+};
+
 
-WiFiClient wifiClient;
-BearSSL::WiFiClientSecure wifiClientSecure;
-WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, NTP_OFFSET);
+NetWiFiClient wifiClient;
+TimedWiFiClientSecure wifiClientSecure;
+// Kept across uploads so the connection and the TLS session can be reused
+HTTPClient pvOutputHttp;
+BearSSL::Session pvOutputTlsSession;
+unsigned long pvOutputIdleSinceMs = 0;
+SntpClient sntpClient(NTP_UPDATE_INTERVAL * 1000UL, sntpResolve);
+Clock wallClock;
 ESP8266WebServer webServer(80);
 PubSubClient pubSubClient(wifiClient);
-Led led(LED_BUILTIN);
+Led led(PIN_LED);
+PowerSave powerSave(POWER_SAVE, POWER_LISTEN_INTERVAL, POWER_IDLE_MAX_MS);
+// PVOutput readings held while WiFi or PVOutput is down, or while uploads are over budget
+PvOutputBacklog pvOutputBacklog;
+// Backlog replay waits after a failed batch, until PVOUTPUT_REPLAY_RETRY has passed or WiFi reconnects
+bool pvOutputReplayHeld = false;
+unsigned long pvOutputReplayHeldMs = 0;
+
+// Loop time budgets for network work, sinks are registered in setup()
+NetScheduler netScheduler(NET_TICK_BUDGET_US);
+uint8_t netSinkWeb = NET_NO_SINK;
+uint8_t netSinkMqttLoop = NET_NO_SINK;
+uint8_t netSinkPublish = NET_NO_SINK;
+uint8_t netSinkPvOutput = NET_NO_SINK;
+uint8_t netSinkLog = NET_NO_SINK;
+uint8_t netSinkBulk = NET_NO_SINK;
+
+#if AURORA_HW_SERIAL
+// Hardware UART: no bit-banged receive interrupts competing with WiFi. Pins are fixed by Serial.swap() in setup()
+#define auroraSerial Serial
+#else
+SoftwareSerial auroraSerial(PIN_AURORA_RX, PIN_AURORA_TX);
+#endif
+AuroraLink auroraLink(&auroraSerial, PIN_AURORA_TX_CTL);
+AuroraScan inverterScan(&auroraLink);
+
+void inverterSweepDone(uint8_t address, uint8_t op, const AuroraReply *reply, unsigned long elapsedUs);
+void inverterSweepLoop(void);
+
+// Status poll list, one request per quantity. The state request goes first, the sweep ends there while the inverter
+// is offline. Size it against UPDATE_PERIOD_STATS with aurora_sweep_duration_seconds and aurora_bus_utilization
+const AuroraSweep::Item inverterSweepItems[] PROGMEM = {
+    {AURORA_OP_STATE, 0},
+    {AURORA_OP_CUMULATED, AURORA_ENERGY_DAILY},
+    {AURORA_OP_CUMULATED, AURORA_ENERGY_LIFETIME},
+    {AURORA_OP_DSP, AURORA_DSP_PIN1, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_PIN2, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_INPUT1_VOLTAGE, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_INPUT1_CURRENT, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_INPUT2_VOLTAGE, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_INPUT2_CURRENT, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_GRID_VOLTAGE, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_GRID_CURRENT, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_GRID_POWER, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_FREQUENCY, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_ISOLATION, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_ILEAK_DCDC, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_ILEAK_INVERTER, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_INVERTER_TEMP, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_BOOSTER_TEMP, AURORA_DSP_GLOBAL},
+};
+
+// Last status snapshot of an inverter, formatted as JSON and optionally published as CBOR
+struct InverterStatus {
+    unsigned long lastUpdate;
+    unsigned long energyToday;
+    unsigned long energyTotal;
+    unsigned long lastPvoutputRead;
+    unsigned long lastPvoutputSent;
+    float pIn;
+    float pIn1;
+    float pIn2;
+    float vIn1;
+    float iIn1;
+    float vIn2;
+    float iIn2;
+    float vGrid;
+    float iGrid;
+    float pGrid;
+    float fGrid;
+    float rIso;
+    float iLeakDcDc;
+    float iLeakInverter;
+    float tempInverter;
+    float tempBooster;
+    float clockOffset;
+    float clockDriftPpm;
+};
+
+const InverterStatus inverterStatusEmpty = {0, 0, 0, 0, 0, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN, NAN};
+
+// One per inverter on the bus, sharing auroraLink
+struct Inverter {
+    uint8_t address;
+    const char *pvOutputSid;
+    AuroraSweep sweep;
+    InverterClock clock;
+    InverterStatus status;
+    // Power reads since the last PVOutput reading
+    PowerWindow power;
+    // Last PVOutput reading and upload
+    unsigned long pvOutputEnergyToday;
+    float pvOutputPower;
+    unsigned long pvOutputLastUpdate;
+    unsigned long pvOutputLastPublished;
+    // Status waiting for the MQTT publish budget
+    bool statusPending;
+};
+
+const uint8_t inverterAddresses[] = INVERTER_ADDRESSES;
+const char *const inverterPvOutputSids[] = PVOUTPUT_API_SIDS;
+
+#define INVERTER_CONFIGURED (sizeof(inverterAddresses) / sizeof(inverterAddresses[0]))
+
+static_assert(sizeof(inverterPvOutputSids) / sizeof(inverterPvOutputSids[0]) == INVERTER_CONFIGURED, "PVOUTPUT_API_SIDS needs one entry per inverter");
+static_assert(INVERTER_CONFIGURED <= INVERTER_MAX, "More INVERTER_ADDRESSES than INVERTER_MAX");
+
+// Active inverters, the configured ones until a bus scan finds others
+Inverter inverters[INVERTER_MAX];
+uint8_t inverterCount = 0;
+
+// Shared bus busy fraction between the last two sweep rounds, all traffic included
+float auroraBusUtilization = NAN;
+unsigned long auroraBusPeriodStartUs = 0;
+uint64_t auroraBusPeriodBusyUs = 0;
+
+#if GRID_CAPTURE
+// Burst sampling of the first inverter while no other sweep or scan needs the bus
+const AuroraSweep::Item gridSweepItems[] PROGMEM = {
+    {AURORA_OP_DSP, AURORA_DSP_GRID_VOLTAGE, AURORA_DSP_GLOBAL},
+    {AURORA_OP_DSP, AURORA_DSP_FREQUENCY, AURORA_DSP_GLOBAL},
+};
+
+AuroraSweep gridSweep;
+GridCapture gridCapture(GRID_VOLTAGE_LOW, GRID_VOLTAGE_HIGH, GRID_FREQUENCY_LOW, GRID_FREQUENCY_HIGH);
+#endif
 
 
+#if !AURORA_HW_SERIAL
 #define STDOUT Serial
+#elif LOG_SERIAL1
+#define STDOUT Serial1
+static_assert(PIN_LED != 2, "LOG_SERIAL1 uses GPIO2, set PIN_LED to another pin");
+#endif
+
+// Log messages are formatted into logRing and drained to STDOUT and MQTT from runLoopHandlers()
+// Format strings must be literals, they are placed in flash
+LogRing logRing;
 
 #ifdef STDOUT
-#define log(...) STDOUT.printf(__VA_ARGS__)
+#define LOG_SINK_STDOUT LOG_SINK_SERIAL
+#else
+// No serial console, UART0 belongs to the inverter. Log to the MQTT log topic, dropped while disconnected
+#define LOG_SINK_STDOUT LOG_SINK_MQTT
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define logError(fmt, ...) logRing.printf_P(LOG_SINK_STDOUT, PSTR(fmt), ##__VA_ARGS__)
+#else
+#define logError(...) do {} while(0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define logWarn(fmt, ...) logRing.printf_P(LOG_SINK_STDOUT, PSTR(fmt), ##__VA_ARGS__)
+#else
+#define logWarn(...) do {} while(0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define log(fmt, ...) logRing.printf_P(LOG_SINK_STDOUT, PSTR(fmt), ##__VA_ARGS__)
 #else
 #define log(...) do {} while(0)
 #endif
 
-#if defined STDOUT && defined DEBUG
-#define debug(...) log(__VA_ARGS__)
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define debug(fmt, ...) logRing.printf_P(LOG_SINK_STDOUT, PSTR(fmt), ##__VA_ARGS__)
 #else
 #define debug(...) do {} while(0)
 #endif
@@ -60,11 +612,44 @@ Led led(LED_BUILTIN);
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Call handlers in loop
+void logDrain();
+void clockSyncNtp();
+bool isWifiConnected();
+
+
 void runLoopHandlers() {
+    wallClock.tick();
+    netScheduler.tick();
+    // Critical network sinks first, the log drain gets what the tick has left
+    unsigned long tStart = micros();
+    uint8_t previousStage = loopStageEnter(STAGE_MQTT_LOOP);
     pubSubClient.loop();
-    timeClient.update();
+    netScheduler.spendSince(netSinkMqttLoop, tStart);
+    metricsLoopHandler[LOOP_HANDLER_MQTT].observeSince(tStart);
+    tStart = micros();
+    loopStageEnter(STAGE_WEB);
     webServer.handleClient();
+    netScheduler.spendSince(netSinkWeb, tStart);
+    metricsLoopHandler[LOOP_HANDLER_WEB].observeSince(tStart);
+    tStart = micros();
+    loopStageEnter(STAGE_NTP);
+    if (sntpClient.loop(isWifiConnected())) {
+        clockSyncNtp();
+    }
+    metricsLoopHandler[LOOP_HANDLER_NTP].observeSince(tStart);
+    tStart = micros();
+    loopStageEnter(STAGE_LOG);
+    logDrain();
+    metricsLoopHandler[LOOP_HANDLER_LOG].observeSince(tStart);
+    tStart = micros();
+    loopStageEnter(STAGE_LED);
     led.loop();
+    metricsLoopHandler[LOOP_HANDLER_LED].observeSince(tStart);
+    tStart = micros();
+    loopStageEnter(STAGE_INVERTER);
+    inverterSweepLoop();
+    metricsLoopHandler[LOOP_HANDLER_INVERTER].observeSince(tStart);
+    loopStageEnter(previousStage);
 }
 
 
@@ -72,6 +657,7 @@ void runLoopDelay(unsigned long delayTime, unsigned long delayResolution=10) {
     unsigned long tStart = millis();
     while((millis() - tStart) < delayTime) {
         runLoopHandlers();
+        LoopStage stage(STAGE_DELAY);
         delay(delayResolution);
     }
 }
@@ -79,20 +665,36 @@ void runLoopDelay(unsigned long delayTime, unsigned long delayResolution=10) {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Time + NTP
-#define TIME_STR timeClient.getFormattedTime().c_str()
+#define TIME_STR formatTime(getEpochTime())
 
 
 char * _formatFloat(char *buf, size_t bufLen, float val) {
     memset(buf, 0, bufLen);
     if (isnan(val)) {
-        strncpy(buf, "NaN", bufLen-1);
+        strncpy_P(buf, PSTR("NaN"), bufLen-1);
     } else {
-        snprintf(buf, bufLen-1, "%.2f", val);
+        snprintf_P(buf, bufLen-1, PSTR("%.2f"), val);
     }
     return buf;
 }
 
 
+// Append formatted text at pos, returns new end position. Output is truncated at bufLen
+size_t _appendf_P(char *buf, size_t bufLen, size_t pos, PGM_P fmt, ...) {
+    if (pos >= bufLen) {
+        return pos;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf_P(buf + pos, bufLen - pos, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return pos;
+    }
+    return min(pos + len, bufLen - 1);
+}
+
+
 static inline unsigned long toLocalTime(unsigned long t) {
     return t + NTP_OFFSET;
 }
@@ -101,9 +703,67 @@ static inline unsigned long fromLocalTime(unsigned long t) {
     return t - NTP_OFFSET;
 }
 
+// Epoch cached once per loop iteration by wallClock.tick(). Never goes backwards
 unsigned long getEpochTime() {
-    // NTPClient adds offset to epoch time. This is incorrect. Fix it.
-    return fromLocalTime(timeClient.getEpochTime());;
+    return wallClock.epoch();
+}
+
+
+// Local time as HH:MM:SS
+const char *formatTime(unsigned long t) {
+    static char timeStr[9];
+    t = toLocalTime(t);
+    snprintf_P(timeStr, sizeof(timeStr), PSTR("%02d:%02d:%02d"), hour(t), minute(t), second(t));
+    return timeStr;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scheduler. Periodic work runs from loop() via scheduler.run()
+Scheduler scheduler(getEpochTime);
+uint8_t taskIdPvOutput = SCHEDULER_NO_TASK;
+uint8_t taskIdStats = SCHEDULER_NO_TASK;
+
+SolarCalendar solarCalendar(SOLAR_LATITUDE, SOLAR_LONGITUDE);
+// Night and no inverter answered the last sweeps
+bool inverterAsleep = false;
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Clock sources. NTP disciplines the clock, the inverter clock is a holdover until NTP first answers
+
+#define CLOCK_SOURCE_NONE     0
+#define CLOCK_SOURCE_INVERTER 1
+#define CLOCK_SOURCE_NTP      2
+
+uint8_t clockSource = CLOCK_SOURCE_NONE;
+
+
+void clockSynced(uint8_t source, uint32_t stepsBefore) {
+    clockSource = source;
+    if (wallClock.steps() != stepsBefore) {
+        // Clock was set or stepped, move aligned tasks to the new wall clock boundaries
+        scheduler.realign();
+        // Inverter clock samples were measured against the old wall clock. A correction clamped to int32 is too
+        // large to carry over, start the models again
+        int32_t stepUs = wallClock.lastCorrectionUs();
+        for (uint8_t i = 0; i < inverterCount; i++) {
+            if (stepUs == INT32_MIN || stepUs == INT32_MAX) {
+                inverters[i].clock = InverterClock();
+            } else {
+                inverters[i].clock.stepped(stepUs / 1e6);
+            }
+        }
+    }
+}
+
+
+// Discipline wallClock from the last NTP reply
+void clockSyncNtp() {
+    uint32_t steps = wallClock.steps();
+    wallClock.sync(sntpClient.epochUs());
+    clockSynced(CLOCK_SOURCE_NTP, steps);
+    debug("Clock: NTP correction %ld us, slewing %ld us, rtt %lu us\n", (long)wallClock.lastCorrectionUs(), (long)wallClock.pendingSlewUs(), (unsigned long)sntpClient.rttUs());
 }
 
 
@@ -116,7 +776,7 @@ char wifiMac[13] = {0};
 char *readWifiMac() {
     byte _wifiMac[6];
     WiFi.macAddress(_wifiMac);
-    snprintf(wifiMac, sizeof(wifiMac), "%02x%02x%02x%02x%02x%02x", _wifiMac[0], _wifiMac[1], _wifiMac[2], _wifiMac[3], _wifiMac[4], _wifiMac[5]);
+    snprintf_P(wifiMac, sizeof(wifiMac), PSTR("%02x%02x%02x%02x%02x%02x"), _wifiMac[0], _wifiMac[1], _wifiMac[2], _wifiMac[3], _wifiMac[4], _wifiMac[5]);
     return wifiMac;
 }
 
@@ -130,88 +790,277 @@ const char mqttUser[] = MQTT_USER;
 const char mqttPassword[] = MQTT_PASSWORD;
 
 
-const char pvoutputAddStatsUrl[] = "https://pvoutput.org/service/r2/addstatus.jsp";
+const char pvoutputAddStatsUrl[] PROGMEM = "https://pvoutput.org/service/r2/addstatus.jsp";
+const char pvoutputAddBatchUrl[] PROGMEM = "https://pvoutput.org/service/r2/addbatchstatus.jsp";
 const char pvoutputApiKey[] = PVOUTPUT_API_KEY;
-const char pvoutputApiSID[] = PVOUTPUT_API_SID;
 
 
-Aurora inverter = Aurora(INVERTER_ADDRESS, PIN_AURORA_RX, PIN_AURORA_TX, PIN_AURORA_TX_CTL);
+// Look a destination up through dnsCache. Returns false if there is no usable address
+bool netResolve(const char *host, IPAddress *ip, bool allowStale) {
+    uint8_t result;
+    {
+        LoopStage stage(STAGE_DNS);
+        result = dnsCache.resolve(host, ip);
+    }
+    if (result == DNS_RESULT_STALE) {
+        logWarn("DNS lookup of %s failed, %S %s\n", host, allowStale ? PSTR("using stale") : PSTR("not using stale"), ip->toString().c_str());
+        return allowStale;
+    }
+    if (result == DNS_RESULT_FAILED) {
+        logError("DNS lookup of %s failed\n", host);
+        return false;
+    }
+    return true;
+}
+
+
+// Connectivity from the WiFi event callbacks, so a drop pauses network work at once rather than through timeouts
+WiFiEventHandler wifiGotIpHandler;
+WiFiEventHandler wifiDisconnectedHandler;
+volatile bool wifiUp = false;
+volatile uint8_t wifiDisconnectReason = 0;
+
+// Outages since boot, counted from the first connection
+uint32_t wifiOutages = 0;
+unsigned long wifiOutageStartMs = 0;
+unsigned long wifiOutageLastMs = 0;
+uint64_t wifiOutageTotalMs = 0;
 
 
 bool isWifiConnected() {
-    return (WiFi.status() == WL_CONNECTED);
+    return wifiUp;
+}
+
+
+// Handlers only set the state, the transitions are acted on in wifiPoll()
+void wifiEventsBegin() {
+    wifiGotIpHandler = WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP &event) {
+        wifiUp = true;
+    });
+    wifiDisconnectedHandler = WiFi.onStationModeDisconnected([](const WiFiEventStationModeDisconnected &event) {
+        wifiUp = false;
+        wifiDisconnectReason = event.reason;
+    });
+}
+
+
+// WiFi association cached in RTC memory for a fast reconnect after a warm reset
+struct WifiCache {
+    uint32_t crc;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+static_assert(sizeof(WifiCache) <= RTC_BLOCKS_WIFI * 4, "WifiCache does not fit its RTC blocks");
+
+bool wifiCacheUsed = false;
+unsigned long wifiBeginMs = 0;
+
+
+// Start connecting, with the cached BSSID, channel and IP configuration if available. Does not wait
+void wifiBegin(bool useCache) {
+    LoopStage stage(STAGE_WIFI);
+    WifiCache cache;
+    wifiBeginMs = millis();
+    wifiCacheUsed = useCache && rtcLoad(RTC_BLOCK_WIFI, &cache, sizeof(cache));
+    if (wifiCacheUsed) {
+        log("WiFi Connecting to: %s (cached channel %u)\n", wifiSsid, cache.channel);
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        WiFi.begin(wifiSsid, wifiPassword, cache.channel, cache.bssid);
+    } else {
+        log("WiFi Connecting to: %s\n", wifiSsid);
+        // All zero configuration selects DHCP
+        WiFi.config(IPAddress(), IPAddress(), IPAddress());
+        WiFi.begin(wifiSsid, wifiPassword);
+    }
+}
+
+
+void wifiCacheStore() {
+    WifiCache cache;
+    memset(&cache, 0, sizeof(cache));
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.ip = WiFi.localIP();
+    cache.gateway = WiFi.gatewayIP();
+    cache.subnet = WiFi.subnetMask();
+    cache.dns = WiFi.dnsIP();
+    rtcStore(RTC_BLOCK_WIFI, &cache, sizeof(cache));
 }
 
 
-void waitForWifi() {
-    while (WiFi.status() != WL_CONNECTED) {
-        log(".");
-        runLoopDelay(500);
+// Background WiFi bring-up and outage tracking, called from loop()
+void wifiPoll() {
+    static bool wasConnected = false;
+    static bool everConnected = false;
+    bool connected = isWifiConnected();
+    if (connected && !wasConnected) {
+        if (everConnected) {
+            wifiOutageLastMs = millis() - wifiOutageStartMs;
+            wifiOutageTotalMs += wifiOutageLastMs;
+            log("%s: WiFi Reconnected: %s after %lu ms outage\n", TIME_STR, WiFi.localIP().toString().c_str(), wifiOutageLastMs);
+        } else {
+            log("WiFi Connected: %s in %lu ms%S\n", WiFi.localIP().toString().c_str(), millis() - wifiBeginMs, wifiCacheUsed ? PSTR(" (cached)") : PSTR(""));
+        }
+        everConnected = true;
+        wifiCacheStore();
+        led.off();
+        // Catch up the clock, and replay the readings held over the outage without waiting for a retry
+        sntpClient.syncNow();
+        pvOutputReplayHeld = false;
+    } else if (!connected && wasConnected) {
+        wifiOutages++;
+        wifiOutageStartMs = millis();
+        logWarn("%s: WiFi Disconnected, reason %u\n", TIME_STR, wifiDisconnectReason);
+        // Drop the stale connections now, mqttConnectPoll() reconnects once WiFi is back
+        pubSubClient.disconnect();
+        wifiClientSecure.stop();
+        led.flashFast();
+    } else if (!connected && wifiCacheUsed && millis() - wifiBeginMs > WIFI_CACHE_TIMEOUT_MS) {
+        logWarn("WiFi cached association failed, scanning\n");
+        wifiBegin(false);
     }
+    wasConnected = connected;
 }
 
 
 #define MQTT_CLIENT_ID_MAX_LEN 64
 
-const char mqttTopicLwt[] = "tele/%s/LWT";
-const char mqttTopicStat[] = "tele/%s/STAT";
-const char mqttTopicPower[] = "tele/%s/POWER";
-const char mqttTopicLog[] = "tele/%s/LOG";
+const char mqttTopicLwt[] PROGMEM = "tele/%s/LWT";
+const char mqttTopicStat[] PROGMEM = "tele/%s/STAT";
+const char mqttTopicPower[] PROGMEM = "tele/%s/POWER";
+const char mqttTopicLog[] PROGMEM = "tele/%s/LOG";
+const char mqttTopicStatCbor[] PROGMEM = "tele/%s/STATCBOR";
+const char mqttTopicStall[] PROGMEM = "tele/%s/STALL";
+const char mqttTopicCmnd[] PROGMEM = "cmnd/%s/+";
+const char mqttTopicCmndStatCbor[] PROGMEM = "cmnd/%s/STATCBOR";
+const char mqttTopicCmndScan[] PROGMEM = "cmnd/%s/SCAN";
+const char mqttTopicScan[] PROGMEM = "tele/%s/SCAN";
+const char mqttTopicGridEvent[] PROGMEM = "tele/%s/GRIDEVENT";
 const char mqttMessageOnline[] = "Online";
 const char mqttMessageOffline[] = "Offline";
 
 static char _mqttTopic[64];
 
 
-char * mqttTopic(const char *topicFmt) {
-    snprintf(_mqttTopic, sizeof(_mqttTopic)-1, topicFmt, mqttTopicName);
+// topicFmt is in flash. With more than one inverter, topics about one get its address appended to the name
+char * mqttTopic(PGM_P topicFmt, uint8_t address = 0) {
+    if (address == 0 || inverterCount <= 1) {
+        snprintf_P(_mqttTopic, sizeof(_mqttTopic)-1, topicFmt, mqttTopicName);
+    } else {
+        char name[sizeof(mqttTopicName) + 4];
+        snprintf_P(name, sizeof(name), PSTR("%s-%u"), mqttTopicName, address);
+        snprintf_P(_mqttTopic, sizeof(_mqttTopic)-1, topicFmt, name);
+    }
     return _mqttTopic;
 }
 
 bool mqttConnected() {
-    return pubSubClient.connected();
-}
-
-void mqttConnectCheck() {
-    // Connect pubSubClient if it is not already connected
-    while (!mqttConnected()) {
-        char clientId[MQTT_CLIENT_ID_MAX_LEN];
-        snprintf(clientId, MQTT_CLIENT_ID_MAX_LEN-1, "%s-%s", mqttTopicName, wifiMac);
-        log("Connecting for MQTT: %s:%d as %s\n", mqttHost, mqttPort, clientId);
-
-        // Attempt to connect
-        char *willTopic = mqttTopic(mqttTopicLwt);
-        if (pubSubClient.connect(clientId, mqttUser, mqttPassword, willTopic, 1, true, mqttMessageOffline)) {
-            log("MQTT connected\n");
-            pubSubClient.publish(willTopic, mqttMessageOnline, true);
-            // Subscribe to topics of interest if there are any
-        } else {
-            log("MQTT connection failed! Error code = %d\n", pubSubClient.state());
-            runLoopDelay(60*1000);
-        }
+    return isWifiConnected() && pubSubClient.connected();
+}
+
+bool mqttConnectOnce() {
+    char clientId[MQTT_CLIENT_ID_MAX_LEN];
+    snprintf_P(clientId, MQTT_CLIENT_ID_MAX_LEN-1, PSTR("%s-%s"), mqttTopicName, wifiMac);
+    log("Connecting for MQTT: %s:%d as %s\n", mqttHost, mqttPort, clientId);
+
+    // Attempt to connect
+    char *willTopic = mqttTopic(mqttTopicLwt);
+    bool connected;
+    {
+        LoopStage stage(STAGE_MQTT_CONNECT);
+        connected = pubSubClient.connect(clientId, mqttUser, mqttPassword, willTopic, 1, true, mqttMessageOffline);
     }
+    flightRecorder.record(FR_EVENT_MQTT, connected, pubSubClient.state());
+    if (connected) {
+        log("MQTT connected\n");
+        metricsMqttPublish(pubSubClient.publish(willTopic, mqttMessageOnline, true));
+        // Subscribe to topics of interest if there are any
+        pubSubClient.subscribe(mqttTopic(mqttTopicCmnd));
+    } else {
+        logError("MQTT connection failed! Error code = %d\n", pubSubClient.state());
+    }
+    return connected;
 }
 
 
-void mqttSend(const char *topic_fmt, const char *msg, bool waitForConnection = false) {
-    if (waitForConnection) {
-        mqttConnectCheck();
+// Background MQTT connection, one attempt per MQTT_RETRY_PERIOD while WiFi is up. Called from loop()
+void mqttConnectPoll() {
+    static unsigned long lastAttempt = 0;
+    static bool attempted = false;
+    if (mqttConnected() || !isWifiConnected()) {
+        return;
+    }
+    if (attempted && millis() - lastAttempt < MQTT_RETRY_PERIOD * 1000UL) {
+        return;
     }
-    const char *topic = mqttTopic(topic_fmt);
+    attempted = true;
+    lastAttempt = millis();
+    mqttConnectOnce();
+}
+
+
+void mqttSend(PGM_P topic_fmt, const char *msg, uint8_t address = 0) {
+    const char *topic = mqttTopic(topic_fmt, address);
     debug("MQTT: Publishing '%s': '%s'\n", topic, msg);
-    pubSubClient.publish(topic, msg);
+    LoopStage stage(STAGE_MQTT_PUBLISH);
+    unsigned long tStart = micros();
+    metricsMqttPublish(pubSubClient.publish(topic, msg));
+    netScheduler.spendSince(netSinkPublish, tStart);
 }
 
 
-void mqttLog(const char *fmt, ...) {
+// Streamed to the client, so the payload may exceed the PubSubClient buffer
+void mqttSendBinary(PGM_P topic_fmt, const uint8_t *msg, size_t len, uint8_t address = 0) {
+    const char *topic = mqttTopic(topic_fmt, address);
+    debug("MQTT: Publishing '%s': %u bytes\n", topic, (unsigned)len);
+    LoopStage stage(STAGE_MQTT_PUBLISH);
+    unsigned long tStart = micros();
+    bool ok = pubSubClient.beginPublish(topic, len, false) && pubSubClient.write(msg, len) == len;
+    metricsMqttPublish(pubSubClient.endPublish() && ok);
+    netScheduler.spendSince(netSinkPublish, tStart);
+}
+
+
+#define mqttLog(fmt, ...) mqttLog_P(PSTR(fmt), ##__VA_ARGS__)
+
+void mqttLog_P(PGM_P fmt, ...) {
+    // Queued to logRing, published by logDrain()
     if (mqttConnected()) {
-        char *topic = mqttTopic(mqttTopicLog);
-        char msg[1024] = {0};
         va_list args;
         va_start(args, fmt);
-        vsnprintf(msg, sizeof(msg)-1, fmt, args);
+        logRing.vprintf_P(LOG_SINK_MQTT, fmt, args);
         va_end(args);
-        pubSubClient.publish(topic, msg);
+    }
+}
+
+
+bool mqttLogPublish(const char *msg) {
+    if (!mqttConnected()) {
+        return false;
+    }
+    LoopStage stage(STAGE_MQTT_PUBLISH);
+    return metricsMqttPublish(pubSubClient.publish(mqttTopic(mqttTopicLog), msg));
+}
+
+
+// Serial takes what it can without blocking and is not a network sink. MQTT log records go one at a time while the
+// log sink has budget, the ring holds the rest. Producers see the backpressure as dropped messages once the ring is full
+void logDrain() {
+#ifdef STDOUT
+    logRing.drainSerial(&STDOUT);
+#else
+    logRing.drainSerial(NULL);
+#endif
+    while (logRing.pending(LOG_SINK_MQTT) > 0 && netScheduler.allow(netSinkLog)) {
+        unsigned long tStart = micros();
+        logRing.drainPublish(mqttLogPublish, 1);
+        netScheduler.spendSince(netSinkLog, tStart);
     }
 }
 
@@ -220,107 +1069,276 @@ void mqttLog(const char *fmt, ...) {
 // Arduino core functions
 
 void pubSubCallback(char* topic, byte* payload, unsigned int length);
-bool inverterReadPVOutputData();
-bool pvOutputSend();
-bool inverterSetTime(void);
-bool inverterOnline(void);
-void inverterUpdateStatus(void);
+bool inverterReadPVOutputData(Inverter *inv);
+bool pvOutputSend(Inverter *inv);
+bool pvOutputBacklogged(uint8_t address);
+void pvOutputReplayPoll(void);
+bool inverterSetTime(Inverter *inv);
+void inverterSetup(const uint8_t *addresses, uint8_t count);
+void inverterSweepStart(void);
+bool inverterScanStart(void);
+void inverterScanDone(void);
+void gridEventPublish(void);
+void statsPeriodUpdate(void);
+bool inverterBusBusy(void);
+void inverterUpdateStatus(Inverter *inv);
+void inverterPublishStatus(Inverter *inv);
 void webHandle404(void);
 void webHandleRoot(void);
+void webHandleInverter(void);
+void webHandleScan(void);
+void webHandleMemory(void);
+void webHandleMetrics(void);
+void webHandleStalls(void);
+void webHandleCrash(void);
+void flightRecorderPoll(void);
+void taskPvOutput(void);
+void taskStats(void);
+void stateRestore(void);
+void stateSave(void);
+bool clockSyncInverter(void);
+size_t formatStall(const StallDetector::Stall *stall, char *buf, size_t bufLen);
+size_t memoryReport(char *buf, size_t bufLen);
 
 
 void setup() {
 
-    delay(1000);
+    // Recover the flight recorder before anything records to it
+    flightRecorder.begin();
+    rst_info *resetInfo = ESP.getResetInfoPtr();
+    flightRecorder.record(FR_EVENT_BOOT, resetInfo->reason, resetInfo->exccause);
+
+    // Warm resets keep RTC memory: skip the boot delays and reuse the cached WiFi association
+    bool fastBoot = FAST_BOOT && resetInfo->reason != REASON_DEFAULT_RST && resetInfo->reason != REASON_EXT_SYS_RST;
+
+    if (!fastBoot) {
+        delay(1000);
+    }
     led.on();
 
     readWifiMac();
     // Configure wifiClientSecure. Either add certificate store, or don't care
     wifiClientSecure.setInsecure();
+    wifiClientSecure.setSession(&pvOutputTlsSession);
+    pvOutputHttp.setReuse(true);
+    pvOutputHttp.setTimeout(NET_READ_TIMEOUT_MS);
 
+#ifdef STDOUT
     // Init serial for debuging
     STDOUT.begin(115200);
+#endif
 
     // Init Inverter
-    inverter.begin();
-
-    for(int i=3; i>0; i--) {
-        log("Starting in %d\n", i);
-        delay(1000);
+    auroraSerial.begin(AURORA_BAUD);
+    auroraLink.begin();
+    inverterSetup(inverterAddresses, INVERTER_CONFIGURED);
+#if AURORA_HW_SERIAL
+    // Move UART0 from the USB bridge to GPIO13 (RX) / GPIO15 (TX)
+    Serial.setDebugOutput(false);
+    Serial.swap();
+#endif
+    // Use the inverter clock until NTP answers
+    clockSyncInverter();
+
+    if (!fastBoot) {
+        for(int i=3; i>0; i--) {
+            log("Starting in %d\n", i);
+            logDrain();
+            delay(1000);
+        }
+    }
+    log("Starting: %s%S\n", wifiMac, fastBoot ? PSTR(" (fast boot)") : PSTR(""));
+    log("Reset reason: %s\n", ESP.getResetReason().c_str());
+    if (flightRecorder.hasDump()) {
+        log("Flight recorder: %u events recovered, last stage %u\n", flightRecorder.dumpCount(), flightRecorder.dumpStage());
     }
-    log("Starting: %s\n", wifiMac);
 
-    // Configre + start WiFi
-    log("WiFi Connecting to: %s\n", wifiSsid);
-    WiFi.begin(wifiSsid, wifiPassword);
+    // Configre + start WiFi. Connection completes in the background, see wifiPoll()
+    powerSave.begin();
+    wifiEventsBegin();
+    wifiBegin(fastBoot);
     led.flashFast();
-    waitForWifi();
-    led.on();
-    log("\nWiFi Connected: %s\n", WiFi.localIP().toString().c_str());
 
-    // Start NTP
-    timeClient.begin();
-    timeClient.setUpdateInterval(5 * 60 * 1000); // Set update to 5 minutes
-    log("Waiting for NTP update:\n.");
-    while (!timeClient.forceUpdate()) {  // Force NTP update
-        delay(500);
-        log(".");
-    }
-    log("\n");
-    log("NTP time: %lu = %s\n", getEpochTime(), timeClient.getFormattedTime().c_str());
+    // Start NTP. Requests are sent from runLoopHandlers(), nothing waits for the reply
+    sntpClient.addServer(NTP_SERVER_1);
+    sntpClient.addServer(NTP_SERVER_2);
+    sntpClient.addServer(NTP_SERVER_3);
+
+    // Schedule periodic work on wall clock boundaries
+    taskIdPvOutput = scheduler.add(PSTR("pvoutput"), taskPvOutput, UPDATE_PERIOD_PVOUTPUT * 1000UL, true, 0, SCHEDULE_COALESCE);
+    taskIdStats = scheduler.add(PSTR("stats"), taskStats, UPDATE_PERIOD_STATS * 1000UL, true, 0, SCHEDULE_SKIP);
+
+    // Network sinks by priority. Web requests and MQTT keepalive always run, bulk work yields to everything else
+    netSinkWeb = netScheduler.add(NET_PRIORITY_CRITICAL, 0);
+    netSinkMqttLoop = netScheduler.add(NET_PRIORITY_CRITICAL, 0);
+    netSinkPublish = netScheduler.add(1, NET_BUDGET_PUBLISH_US);
+    netSinkPvOutput = netScheduler.add(1, NET_BUDGET_PVOUTPUT_US);
+    netSinkLog = netScheduler.add(2, NET_BUDGET_LOG_US);
+    netSinkBulk = netScheduler.add(3, NET_BUDGET_BULK_US);
+
+    // Resume serving the last status and catch up a missed PVOutput slot
+    stateRestore();
 
     // Configure web server
     webServer.on("/", webHandleRoot);
+    webServer.on(UriBraces("/inverter/{}"), webHandleInverter);
+    webServer.on("/scan", webHandleScan);
+    webServer.on("/memory", webHandleMemory);
+    webServer.on("/metrics", webHandleMetrics);
+    webServer.on("/stalls", webHandleStalls);
+    webServer.on("/crash", webHandleCrash);
     webServer.begin();
 
     // Configure MQTT
     pubSubClient.setServer(mqttHost, mqttPort);
+    pubSubClient.setSocketTimeout((NET_READ_TIMEOUT_MS + 999) / 1000);
     pubSubClient.setCallback(pubSubCallback);
-    mqttConnectCheck();
 
-    led.on();
-    runLoopDelay(2000);
-    led.off();
+    // First sample while the network is still coming up, completed from loop()
+    inverterSweepStart();
+#if INVERTER_SCAN_BOOT
+    // Runs once the first sweeps are done
+    inverterScanStart();
+#endif
+
+    char report[512];
+    memoryReport(report, sizeof(report));
+    log("Memory: %s\n", report);
+    if (ESP.getFreeHeap() < MEMORY_FREE_HEAP_WARN) {
+        logWarn("Memory: free heap %u below %u\n", (unsigned)ESP.getFreeHeap(), (unsigned)MEMORY_FREE_HEAP_WARN);
+    }
+
+    if (!fastBoot) {
+        runLoopDelay(2000);
+    }
 }
 
 
 void loop() {
-    static unsigned long nextUpdateTime = (getEpochTime() / UPDATE_PERIOD_PVOUTPUT) * UPDATE_PERIOD_PVOUTPUT + UPDATE_PERIOD_PVOUTPUT;
-    static unsigned long nextStatsTime = (getEpochTime() / UPDATE_PERIOD_STATS) * UPDATE_PERIOD_STATS + UPDATE_PERIOD_STATS;
-    bool pvOutputUpdatePending = false;
+    unsigned long tLoop = micros();
+    stallDetector.loopStart();
 
     runLoopHandlers();
+    wifiPoll();
+    mqttConnectPoll();
+    scheduler.run();
+
+    bool swept = false;
+    bool sweeping = false;
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        if (inverters[i].sweep.finished()) {
+            inverterUpdateStatus(&inverters[i]);
+            swept = true;
+        }
+        sweeping = sweeping || inverters[i].sweep.running();
+    }
+    if (swept && !sweeping) {
+        statsPeriodUpdate();
+    }
+    for (uint8_t i = 0; i < inverterCount && mqttConnected(); i++) {
+        if (inverters[i].statusPending && netScheduler.allow(netSinkPublish)) {
+            inverterPublishStatus(&inverters[i]);
+        }
+    }
+    pvOutputReplayPoll();
+    if (inverterScan.finished()) {
+        inverterScanDone();
+    }
+#if GRID_CAPTURE
+    if (gridCapture.ready()) {
+        gridEventPublish();
+    }
+#endif
+
+    metricsLoop.observeSince(tLoop);
+    flightRecorderPoll();
+    const StallDetector::Stall *stall = stallDetector.loopEnd(getEpochTime());
+    if (stall) {
+        flightRecorder.record(FR_EVENT_STALL, stall->stage, min(stall->durationMs, (uint32_t)0xffff));
+        char stallJson[128];
+        formatStall(stall, stallJson, sizeof(stallJson));
+        logWarn("%s: Loop stall: %s\n", TIME_STR, stallJson);
+        if (mqttConnected() && netScheduler.allow(netSinkPublish)) {
+            mqttSend(mqttTopicStall, stallJson);
+        }
+    }
+    // Sleep until the next scheduled task. A bus exchange in flight is polled without a break
+    powerSave.idle(inverterBusBusy() ? 0 : scheduler.nextDueMs());
+}
 
-    if (getEpochTime() >= nextUpdateTime) {
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scheduled tasks
+
+
+// Every UPDATE_PERIOD_PVOUTPUT: set inverter time, read daily energy and send to PVOutput
+void taskPvOutput() {
+    if (!wallClock.isSet()) {
+        logWarn("%s: Clock not set, skipping PV Output update\n", TIME_STR);
+        return;
+    }
+    if (inverterAsleep) {
+        debug("%s: Inverters asleep, skipping PV Output update\n", TIME_STR);
+        return;
+    }
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        Inverter *inv = &inverters[i];
         // Update time on inverter
-        inverterSetTime();
+        inverterSetTime(inv);
+        if (inv->pvOutputSid == NULL) {
+            // Found by a bus scan, no PVOutput system configured
+            continue;
+        }
         // Read daily cumilative energy
-        if (inverterReadPVOutputData()) {
-            pvOutputUpdatePending = true;
-            led.flashFast(1);
-        } else {
+        if (!inverterReadPVOutputData(inv)) {
             led.flashFast(4);
+            continue;
         }
-        nextUpdateTime += UPDATE_PERIOD_PVOUTPUT;
-        log("%s: Cumulative Energy updated. Next update scheduled at %lu\n", TIME_STR, nextUpdateTime);
-    }
-    if (getEpochTime() >= nextStatsTime) {
-        inverterUpdateStatus();
-        nextStatsTime += UPDATE_PERIOD_STATS;
         led.flashFast(1);
-    }
-    if (pvOutputUpdatePending) {
-        if (WiFi.status() == WL_CONNECTED) {
-            // Try to send PVOutput
-            if (pvOutputSend()) {
-                pvOutputUpdatePending = false;
-                led.flashFast(2);
-            } else {
-                led.flashFast(5);
-                runLoopDelay(1000);
-            }
+        // Sent live only if nothing older is waiting, so readings reach PVOutput in order
+        if (isWifiConnected() && !pvOutputBacklogged(inv->address) && netScheduler.allow(netSinkPvOutput) && pvOutputSend(inv)) {
+            led.flashFast(2);
+        } else {
+            // Replayed in a batch once WiFi, PVOutput and the budgets allow
+            pvOutputBacklog.push(inv->address, inv->pvOutputLastUpdate, inv->pvOutputEnergyToday, inv->pvOutputPower);
+            led.flashFast(5);
         }
     }
+    log("%s: PV Output updated. Next update in %lu s\n", TIME_STR, (unsigned long)scheduler.dueMs(taskIdPvOutput) / 1000);
+}
+
+
+// Stats period from the sun and the inverters: full rate in daylight or while any inverter answers, a slow probe
+// around dawn, near idle at night. Called once all sweeps are done, so the probe that finds an inverter awake
+// returns the first sample of the day and switches to full rate straight away
+void statsPeriodUpdate() {
+    bool online = false;
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        online = online || inverters[i].sweep.online();
+    }
+    uint8_t phase = solarCalendar.phase(getEpochTime(), SOLAR_DAWN_LEAD, SOLAR_DUSK_MARGIN);
+    uint32_t period = UPDATE_PERIOD_STATS;
+    if (!online && phase == SOLAR_DAWN) {
+        period = UPDATE_PERIOD_DAWN;
+    } else if (!online && phase == SOLAR_NIGHT) {
+        period = UPDATE_PERIOD_NIGHT;
+    }
+    inverterAsleep = !online && phase == SOLAR_NIGHT;
+    if (period * 1000UL != scheduler.periodMs(taskIdStats)) {
+        log("%s: Stats period %lu s (%S)\n", TIME_STR, (unsigned long)period,
+            online ? PSTR("online") : phase == SOLAR_DAWN ? PSTR("dawn") : phase == SOLAR_NIGHT ? PSTR("night") : PSTR("day"));
+        scheduler.setPeriod(taskIdStats, period * 1000UL);
+    }
+}
+
+
+// Every stats period: start the inverter sweeps, status is updated and published as each finishes
+void taskStats() {
+    if (clockSource == CLOCK_SOURCE_NONE) {
+        clockSyncInverter();
+    }
+    // Status is updated when the sweep finishes, see loop()
+    inverterSweepStart();
 }
 
 
@@ -328,8 +1346,24 @@ void loop() {
 // PubSubClient handlers
 
 
+#if MQTT_STAT_CBOR
+bool mqttStatCbor = MQTT_STAT_CBOR_ENABLED;
+#endif
+
+
 void pubSubCallback(char* topic, byte* payload, unsigned int length) {
-    log("Message arrived [%s] %s\n", topic, (char *)payload);
+    char msg[32] = {0};
+    memcpy(msg, payload, min(length, (unsigned int)sizeof(msg)-1));
+    log("Message arrived [%s] %s\n", topic, msg);
+#if MQTT_STAT_CBOR
+    if (strcmp(topic, mqttTopic(mqttTopicCmndStatCbor)) == 0) {
+        mqttStatCbor = (strcasecmp_P(msg, PSTR("ON")) == 0 || strcmp_P(msg, PSTR("1")) == 0);
+        log("CBOR status %S\n", mqttStatCbor ? PSTR("enabled") : PSTR("disabled"));
+    }
+#endif
+    if (strcmp(topic, mqttTopic(mqttTopicCmndScan)) == 0) {
+        inverterScanStart();
+    }
 }
 
 
@@ -337,132 +1371,420 @@ void pubSubCallback(char* topic, byte* payload, unsigned int length) {
 // Inverter functions
 
 
-unsigned long pvOutputEnergyToday = 0;
-float         pvOutputPower = NAN;
-unsigned long pvOutputLastUpdate = 0;
-unsigned long pvOutputLastPublished = 0;
-char          inverterStatus[2048] = "{}";
+// millis() at the first inverter sample after boot
+unsigned long bootFirstSampleMs = 0;
+// Scratch buffer for an inverter status formatted as JSON
+char inverterStatusJson[1024];
 
 
-bool inverterOnline() {
-    // Check if inverter is online
-    Aurora::DataState dataState = inverter.readState();
-    return dataState.state.readState;
+void logInverterError(uint8_t address, uint8_t op, const AuroraReply *reply) {
+    // Code text is copied out of flash only here
+    char text[48] = "unknown";
+    PGM_P textP;
+    if (reply->result == AURORA_REFUSED) {
+        textP = AuroraFrame::transmissionStateText(reply->transmissionState);
+    } else {
+        textP = AuroraFrame::resultText(reply->result);
+    }
+    if (textP) {
+        strncpy_P(text, textP, sizeof(text) - 1);
+    }
+    logError("Inverter %u Error: command %u: %s (%u)\n", address, op, text, reply->result == AURORA_REFUSED ? reply->transmissionState : reply->result);
 }
 
 
-void logInverterState(const char *action, Aurora::OutcomeState *state) {
-    // Log Aurora
-    log("Inverter Error: %s: %s (%d), %s\n", action, state->getGlobalState().c_str(), state->readState, state->getTransmissionState().c_str());
+// Inverter requests are wrapped to record latency and failures per command type, and to log failures
+bool inverterRequest(uint8_t address, uint8_t cmd, uint8_t op, const uint8_t *params, AuroraReply *reply) {
+    LoopStage stage(STAGE_INVERTER);
+    unsigned long tStart = micros();
+    uint8_t result = auroraLink.request(address, op, params, reply);
+    auroraRequestDone(cmd, tStart, result);
+    if (result != AURORA_OK) {
+        logInverterError(address, op, reply);
+        return false;
+    }
+    return true;
 }
 
 
-float inverterReadDSP(byte type) {
-    Aurora::DataDSP dataDSP = inverter.readDSP(type);
-    if (!dataDSP.state.readState) {
-        logInverterState("inverterReadDSP", &dataDSP.state);
-        return NAN;
+bool inverterReadCumulatedEnergy(uint8_t address, uint8_t period, unsigned long *energy) {
+    AuroraReply reply;
+    uint8_t params[6] = {period};
+    if (!inverterRequest(address, AURORA_CMD_CUMULATED_ENERGY, AURORA_OP_CUMULATED, params, &reply)) {
+        return false;
     }
-    return dataDSP.value;
+    *energy = AuroraFrame::dataU32(&reply);
+    return true;
 }
 
 
-bool inverterReadPVOutputData() {
-    unsigned long now = getEpochTime();
-    // Read inverter cumulative daily energy and current power, set PVOutpu globals. Returns true on success.
-    Aurora::DataCumulatedEnergy cumulatedEnergy = inverter.readCumulatedEnergy(CUMULATED_DAILY_ENERGY);
-    if (!cumulatedEnergy.state.readState) {
-        logInverterState("readCumulatedEnergy CUMULATED_DAILY_ENERGY", &cumulatedEnergy.state);
+// Inverter clock in local time, epoch seconds
+bool inverterReadTimeDate(uint8_t address, unsigned long *epochLocalTime) {
+    AuroraReply reply;
+    if (!inverterRequest(address, AURORA_CMD_TIME_READ, AURORA_OP_TIME_READ, NULL, &reply)) {
         return false;
     }
-    pvOutputEnergyToday = cumulatedEnergy.energy;
-    float pIn1 = inverterReadDSP(DSP_PIN1_ALL);
-    float pIn2 = inverterReadDSP(DSP_PIN2);
-    if (isnan(pIn1) || isnan(pIn2)) {
+    *epochLocalTime = AuroraFrame::dataU32(&reply) + AURORA_EPOCH_OFFSET;
+    return true;
+}
+
+
+bool inverterWriteTimeDate(uint8_t address, unsigned long epochLocalTime) {
+    AuroraReply reply;
+    uint32_t t = epochLocalTime - AURORA_EPOCH_OFFSET;
+    uint8_t params[6] = {(uint8_t)(t >> 24), (uint8_t)(t >> 16), (uint8_t)(t >> 8), (uint8_t)t};
+    return inverterRequest(address, AURORA_CMD_TIME_WRITE, AURORA_OP_TIME_WRITE, params, &reply);
+}
+
+
+float inverterReadDSP(uint8_t address, uint8_t type) {
+    AuroraReply reply;
+    uint8_t params[6] = {type, AURORA_DSP_GLOBAL};
+    if (!inverterRequest(address, AURORA_CMD_DSP, AURORA_OP_DSP, params, &reply)) {
+        return NAN;
+    }
+    return AuroraFrame::dataFloat(&reply);
+}
+
+
+void inverterSweepDone(uint8_t address, uint8_t op, const AuroraReply *reply, unsigned long elapsedUs) {
+    auroraRequestObserve(auroraCmd(op), elapsedUs, reply->result);
+    if (reply->result != AURORA_OK) {
+        logInverterError(address, op, reply);
+    }
+}
+
+
+void inverterSwap(uint8_t i, uint8_t j) {
+    if (i != j) {
+        Inverter inv = inverters[i];
+        inverters[i] = inverters[j];
+        inverters[j] = inv;
+    }
+}
+
+
+// Make addresses the active inverter list. Inverters already in the list keep their state.
+// Reordered in place: inverters[i..previousEnd) hold the previous inverters not placed yet
+void inverterSetup(const uint8_t *addresses, uint8_t count) {
+    count = min(count, (uint8_t)INVERTER_MAX);
+    uint8_t previousEnd = inverterCount;
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t j = i;
+        while (j < previousEnd && inverters[j].address != addresses[i]) {
+            j++;
+        }
+        if (j < previousEnd) {
+            inverterSwap(i, j);
+            continue;
+        }
+        if (i < previousEnd) {
+            // Overwrite a previous inverter no later address wants, or else move inverters[i] past the end. There is
+            // room for that: the previous inverters left then all match later addresses
+            for (j = i; j < previousEnd; j++) {
+                uint8_t k = i + 1;
+                while (k < count && addresses[k] != inverters[j].address) {
+                    k++;
+                }
+                if (k == count) {
+                    break;
+                }
+            }
+            if (j < previousEnd) {
+                inverterSwap(i, j);
+            } else {
+                inverterSwap(i, previousEnd++);
+            }
+        }
+        Inverter *inv = &inverters[i];
+        inv->address = addresses[i];
+        inv->pvOutputSid = NULL;
+        for (uint8_t k = 0; k < INVERTER_CONFIGURED; k++) {
+            if (inverterAddresses[k] == inv->address) {
+                inv->pvOutputSid = inverterPvOutputSids[k];
+            }
+        }
+        inv->clock = InverterClock();
+        inv->power = PowerWindow();
+        inv->status = inverterStatusEmpty;
+        inv->pvOutputEnergyToday = 0;
+        inv->pvOutputPower = NAN;
+        inv->pvOutputLastUpdate = 0;
+        inv->pvOutputLastPublished = 0;
+        inv->statusPending = false;
+        inv->sweep = AuroraSweep();
+        inv->sweep.begin(&auroraLink, inverterSweepDone, inv->address, inverterSweepItems, sizeof(inverterSweepItems) / sizeof(inverterSweepItems[0]));
+    }
+    inverterCount = count;
+}
+
+
+void inverterSweepStart() {
+    if (inverterScan.running()) {
+        logWarn("%s: Inverter bus scan running, skipping sweep\n", TIME_STR);
+        return;
+    }
+    unsigned long now = micros();
+    uint64_t busy = auroraLink.busyUs();
+    if (auroraBusPeriodStartUs != 0 && now != auroraBusPeriodStartUs) {
+        auroraBusUtilization = (float)(busy - auroraBusPeriodBusyUs) / (now - auroraBusPeriodStartUs);
+    }
+    auroraBusPeriodStartUs = now;
+    auroraBusPeriodBusyUs = busy;
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        if (!inverters[i].sweep.start()) {
+            logWarn("%s: Inverter %u sweep still running, skipping\n", TIME_STR, inverters[i].address);
+        }
+    }
+}
+
+
+// Sweeps share the bus request by request, round robin, so a slow or offline inverter never holds up the others.
+// A bus scan waits for running sweeps to finish, new sweeps do not start while it runs
+void inverterSweepLoop() {
+    static uint8_t first = 0;
+    bool sweeping = false;
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        uint8_t id = (first + i) % inverterCount;
+        if (inverters[id].sweep.loop()) {
+            first = id + 1;
+        }
+        sweeping = sweeping || inverters[id].sweep.running();
+    }
+#if GRID_CAPTURE
+    // Lowest priority: a grid sample only starts on an idle bus, and only while the inverter is up
+    if (gridSweep.finished() && gridSweep.online()) {
+        const AuroraReply *voltage = gridSweep.reply(AURORA_OP_DSP, AURORA_DSP_GRID_VOLTAGE);
+        const AuroraReply *frequency = gridSweep.reply(AURORA_OP_DSP, AURORA_DSP_FREQUENCY);
+        gridCapture.add(millis(), voltage ? AuroraFrame::dataFloat(voltage) : NAN, frequency ? AuroraFrame::dataFloat(frequency) : NAN);
+    }
+    if (!sweeping && !gridSweep.running() && !inverterScan.running() && inverters[0].sweep.online()) {
+        gridSweep.begin(&auroraLink, inverterSweepDone, inverters[0].address, gridSweepItems, sizeof(gridSweepItems) / sizeof(gridSweepItems[0]));
+        gridSweep.start();
+    }
+    gridSweep.loop();
+    sweeping = sweeping || gridSweep.running();
+#endif
+    if (!sweeping && inverterScan.running()) {
+        inverterScan.loop();
+    }
+}
+
+
+#if GRID_CAPTURE
+// Called when a grid event window is complete. Kept frozen until MQTT takes it, the ring stops meanwhile
+void gridEventPublish() {
+    static bool logged = false;
+    if (!logged) {
+        logWarn("%s: Grid event, cause 0x%02x, %lu ms ago\n", TIME_STR, gridCapture.cause(), millis() - gridCapture.triggerMs());
+        logged = true;
+    }
+    if (!mqttConnected() || !netScheduler.allow(netSinkPublish)) {
+        return;
+    }
+    uint8_t record[640];
+    unsigned long epoch = getEpochTime() - (millis() - gridCapture.triggerMs()) / 1000;
+    size_t recordLen = gridCapture.encode(record, sizeof(record), inverters[0].address, epoch);
+    if (recordLen > 0) {
+        mqttSendBinary(mqttTopicGridEvent, record, recordLen);
+    } else {
+        logError("%s: Grid event record too large\n", TIME_STR);
+    }
+    gridCapture.rearm();
+    logged = false;
+}
+#endif
+
+
+// A sweep, sample or scan is using the bus
+bool inverterBusBusy() {
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        if (inverters[i].sweep.running()) {
+            return true;
+        }
+    }
+#if GRID_CAPTURE
+    if (gridSweep.running()) {
+        return true;
+    }
+#endif
+    return inverterScan.running();
+}
+
+
+bool inverterScanStart() {
+    if (!inverterScan.start()) {
+        logWarn("%s: Inverter bus scan already running\n", TIME_STR);
         return false;
     }
-    pvOutputPower = pIn1 + pIn2;
-    pvOutputLastUpdate = now;
-    log("%s: Updated Today's energy: %lu (%lu) = %lu, %.2f\n", TIME_STR, pvOutputLastUpdate, toLocalTime(now), pvOutputEnergyToday, pvOutputPower);
-    mqttLog("updated Today's energy: %lu (%lu) = %lu, %.2f", pvOutputLastUpdate, toLocalTime(now), pvOutputEnergyToday, pvOutputPower);
+    log("%s: Scanning inverter bus, addresses %u to %u\n", TIME_STR, AURORA_SCAN_FIRST, AURORA_SCAN_LAST);
     return true;
 }
 
 
-bool inverterSetTime() {
-    unsigned long inverterEpochLocalTime = 0;
-    Aurora::DataTimeDate dataTimeDate = inverter.readTimeDate();
-    if (!dataTimeDate.state.readState) {
-        logInverterState("readTimeDate", &dataTimeDate.state);
+size_t inverterFormatScanJson(char *buf, size_t bufLen) {
+    size_t pos = 0;
+    pos = _appendf_P(buf, bufLen, pos, PSTR("{\"running\": %S, \"scans\": %u, \"duration\": %.3f, \"found\": ["),
+        inverterScan.running() ? PSTR("true") : PSTR("false"), (unsigned)inverterScan.scans(), inverterScan.durationUs() / 1e6);
+    for (uint8_t i = 0; i < inverterScan.count(); i++) {
+        pos = _appendf_P(buf, bufLen, pos, i == 0 ? PSTR("%u") : PSTR(", %u"), inverterScan.addresses()[i]);
+    }
+    pos = _appendf_P(buf, bufLen, pos, PSTR("], \"active\": ["));
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        pos = _appendf_P(buf, bufLen, pos, i == 0 ? PSTR("%u") : PSTR(", %u"), inverters[i].address);
+    }
+    return _appendf_P(buf, bufLen, pos, PSTR("]}"));
+}
+
+
+// Called when a bus scan finishes: poll the inverters found from now on
+void inverterScanDone() {
+    if (inverterScan.count() > 0) {
+        inverterSetup(inverterScan.addresses(), inverterScan.count());
     } else {
-        inverterEpochLocalTime = dataTimeDate.epochTime;
+        logWarn("%s: Inverter bus scan found no inverters, keeping the current list\n", TIME_STR);
+    }
+    char scanJson[128];
+    inverterFormatScanJson(scanJson, sizeof(scanJson));
+    log("%s: Inverter bus scan took %lu ms: %s\n", TIME_STR, inverterScan.durationUs() / 1000, scanJson);
+    if (mqttConnected()) {
+        mqttSend(mqttTopicScan, scanJson);
+    }
+    inverterSweepStart();
+}
+
+
+float inverterSweepDSP(Inverter *inv, uint8_t type) {
+    const AuroraReply *reply = inv->sweep.reply(AURORA_OP_DSP, type);
+    return reply ? AuroraFrame::dataFloat(reply) : NAN;
+}
+
+
+unsigned long inverterSweepEnergy(Inverter *inv, uint8_t period) {
+    const AuroraReply *reply = inv->sweep.reply(AURORA_OP_CUMULATED, period);
+    return reply ? AuroraFrame::dataU32(reply) : 0;
+}
+
+
+bool inverterReadPVOutputData(Inverter *inv) {
+    unsigned long now = getEpochTime();
+    // Read inverter cumulative daily energy and current power, set PVOutput data. Returns true on success.
+    if (!inverterReadCumulatedEnergy(inv->address, AURORA_ENERGY_DAILY, &inv->pvOutputEnergyToday)) {
+        return false;
     }
-    unsigned long newEpochLocalTime = toLocalTime(getEpochTime());
-    log("%s: Setting inverter time: was %lu setting to: %lu\n", TIME_STR, inverterEpochLocalTime, newEpochLocalTime);
-    if (!inverter.writeTimeDate(newEpochLocalTime)) {
-        log("Inverter error writeTimeDate\n");
+    // Report the time weighted mean of the power read by every sweep since the last reading. Read it now only if
+    // the window is empty, e.g. after boot
+    if (inv->power.count() == 0) {
+        float pIn1 = inverterReadDSP(inv->address, AURORA_DSP_PIN1);
+        float pIn2 = inverterReadDSP(inv->address, AURORA_DSP_PIN2);
+        if (isnan(pIn1) || isnan(pIn2)) {
+            return false;
+        }
+        inv->power.add(millis(), pIn1 + pIn2);
+    }
+    inv->pvOutputPower = inv->power.mean();
+    inv->pvOutputLastUpdate = now;
+    log("%s: Inverter %u updated Today's energy: %lu (%lu) = %lu, %.2f\n", TIME_STR, inv->address, inv->pvOutputLastUpdate, toLocalTime(now), inv->pvOutputEnergyToday, inv->pvOutputPower);
+    debug("%s: Inverter %u power over %u reads: min %.2f, max %.2f\n", TIME_STR, inv->address, inv->power.count(), inv->power.minimum(), inv->power.maximum());
+    inv->power.reset();
+    mqttLog("inverter %u updated Today's energy: %lu (%lu) = %lu, %.2f", inv->address, inv->pvOutputLastUpdate, toLocalTime(now), inv->pvOutputEnergyToday, inv->pvOutputPower);
+    return true;
+}
+
+
+// Set the wall clock from the inverter clock, if no better source has set it yet
+bool clockSyncInverter() {
+    if (clockSource != CLOCK_SOURCE_NONE) {
+        return true;
+    }
+    // The first inverter is the time reference
+    unsigned long inverterTime;
+    if (!inverterReadTimeDate(inverters[0].address, &inverterTime)) {
         return false;
     }
+    uint32_t steps = wallClock.steps();
+    wallClock.sync((uint64_t)fromLocalTime(inverterTime) * 1000000);
+    clockSynced(CLOCK_SOURCE_INVERTER, steps);
+    log("%s: Clock set from inverter: %lu\n", TIME_STR, getEpochTime());
     return true;
 }
 
 
-void inverterUpdateStatus() {
-    unsigned long energyToday = 0;
-    unsigned long energyLifetime = 0;
-    float pIn1 = NAN;
-    float pIn2 = NAN;
-    float pIn = NAN;
-    float vGrid = NAN;
-    float fGrid = NAN;
-    float tempInverter = NAN;
-    float tempBooster = NAN;
+// Keep the inverter clock within INVERTER_CLOCK_MAX_ERROR. The clock is read only when the drift model is due a
+// new sample or predicts too large an error, and written only when the measured error is too large.
+bool inverterSetTime(Inverter *inv) {
+    if (clockSource != CLOCK_SOURCE_NTP) {
+        // Do not write back a holdover time
+        return false;
+    }
     unsigned long now = getEpochTime();
+    if (!inv->clock.readDue(now, INVERTER_CLOCK_READ_PERIOD, INVERTER_CLOCK_MAX_ERROR)) {
+        debug("%s: Inverter %u clock predicted error %.2f s, drift %.2f ppm\n", TIME_STR, inv->address, inv->clock.predict(now), inv->clock.driftPpm());
+        return true;
+    }
+    unsigned long inverterTime;
+    if (!inverterReadTimeDate(inv->address, &inverterTime)) {
+        return false;
+    }
+    now = getEpochTime();
+    long offset = (long)(fromLocalTime(inverterTime) - now);
+    inv->clock.sample(now, offset);
+    if (labs(offset) < INVERTER_CLOCK_MAX_ERROR) {
+        debug("%s: Inverter %u clock offset %ld s, drift %.2f ppm\n", TIME_STR, inv->address, offset, inv->clock.driftPpm());
+        return true;
+    }
+    unsigned long newEpochLocalTime = toLocalTime(now);
+    log("%s: Setting inverter %u time: was %lu setting to: %lu (drift %.2f ppm)\n", TIME_STR, inv->address, inverterTime, newEpochLocalTime, inv->clock.driftPpm());
+    if (!inverterWriteTimeDate(inv->address, newEpochLocalTime)) {
+        logError("Inverter %u error writeTimeDate\n", inv->address);
+        return false;
+    }
+    inv->clock.written(now);
+    return true;
+}
+
+
+void inverterFormatStatusJson(const InverterStatus *status, char *buf, size_t bufLen) {
     char pIn1_s[20];
     char pIn2_s[20];
     char pIn_s[20];
+    char vIn1_s[20];
+    char iIn1_s[20];
+    char vIn2_s[20];
+    char iIn2_s[20];
     char vGrid_s[20];
+    char iGrid_s[20];
+    char pGrid_s[20];
     char fGrid_s[20];
+    char rIso_s[20];
+    char iLeakDcDc_s[20];
+    char iLeakInverter_s[20];
     char tempInverter_s[20];
     char tempBooster_s[20];
-   
-    if (!inverterOnline()) {
-        log("%s: Can not update inverter stats - inverter offline\n", TIME_STR);
-        return;
-    }
- 
-    Aurora::DataCumulatedEnergy cumulatedEnergy = inverter.readCumulatedEnergy(CUMULATED_DAILY_ENERGY);
-    if (!cumulatedEnergy.state.readState) {
-        logInverterState("readCumulatedEnergy CUMULATED_DAILY_ENERGY", &cumulatedEnergy.state);
-    } else {
-        energyToday = cumulatedEnergy.energy;
-    }
-    cumulatedEnergy = inverter.readCumulatedEnergy(CUMULATED_TOTAL_ENERGY_LIFETIME);
-    if (!cumulatedEnergy.state.readState) {
-        logInverterState("readCumulatedEnergy CUMULATED_DAILY_ENERGY", &cumulatedEnergy.state);
-    } else {
-        energyLifetime = cumulatedEnergy.energy;
-    }
-    pIn1 = inverterReadDSP(DSP_PIN1_ALL);
-    pIn2 = inverterReadDSP(DSP_PIN2);
-    vGrid = inverterReadDSP(DSP_GRID_VOLTAGE_ALL);
-    fGrid = inverterReadDSP(DSP_FREQUENCY_ALL);
-    tempInverter = inverterReadDSP(DSP_INVERTER_TEMPERATURE_GT);
-    tempBooster = inverterReadDSP(DSP_BOOSTER_TEMPERATURE_GT);
-    if (!isnan(pIn1) && !isnan(pIn2)) {
-        pIn = pIn1 + pIn2;
-    }
-    _formatFloat(pIn_s, sizeof(pIn_s), pIn),
-    _formatFloat(pIn1_s, sizeof(pIn1_s), pIn1),
-    _formatFloat(pIn2_s, sizeof(pIn2_s), pIn2),
-    _formatFloat(vGrid_s, sizeof(vGrid_s), vGrid),
-    _formatFloat(fGrid_s, sizeof(fGrid_s), fGrid),
-    _formatFloat(tempInverter_s, sizeof(tempInverter_s), tempInverter),
-    _formatFloat(tempBooster_s, sizeof(tempBooster_s), tempBooster),
-
-    // Format last status
-    snprintf(inverterStatus, sizeof(inverterStatus),
-        (
+    char clockOffset_s[20];
+    char clockDrift_s[20];
+
+    _formatFloat(pIn_s, sizeof(pIn_s), status->pIn);
+    _formatFloat(pIn1_s, sizeof(pIn1_s), status->pIn1);
+    _formatFloat(pIn2_s, sizeof(pIn2_s), status->pIn2);
+    _formatFloat(vIn1_s, sizeof(vIn1_s), status->vIn1);
+    _formatFloat(iIn1_s, sizeof(iIn1_s), status->iIn1);
+    _formatFloat(vIn2_s, sizeof(vIn2_s), status->vIn2);
+    _formatFloat(iIn2_s, sizeof(iIn2_s), status->iIn2);
+    _formatFloat(vGrid_s, sizeof(vGrid_s), status->vGrid);
+    _formatFloat(iGrid_s, sizeof(iGrid_s), status->iGrid);
+    _formatFloat(pGrid_s, sizeof(pGrid_s), status->pGrid);
+    _formatFloat(fGrid_s, sizeof(fGrid_s), status->fGrid);
+    _formatFloat(rIso_s, sizeof(rIso_s), status->rIso);
+    _formatFloat(iLeakDcDc_s, sizeof(iLeakDcDc_s), status->iLeakDcDc);
+    _formatFloat(iLeakInverter_s, sizeof(iLeakInverter_s), status->iLeakInverter);
+    _formatFloat(tempInverter_s, sizeof(tempInverter_s), status->tempInverter);
+    _formatFloat(tempBooster_s, sizeof(tempBooster_s), status->tempBooster);
+    _formatFloat(clockOffset_s, sizeof(clockOffset_s), status->clockOffset);
+    _formatFloat(clockDrift_s, sizeof(clockDrift_s), status->clockDriftPpm);
+
+    snprintf_P(buf, bufLen,
+        PSTR(
             "{"
                 "\"last_update\": %lu, "
                 "\"energy_today\": %lu, "
@@ -472,32 +1794,186 @@ void inverterUpdateStatus() {
                 "\"p_in\": %s, "
                 "\"p_in_1\": %s, "
                 "\"p_in_2\": %s, "
+                "\"v_in_1\": %s, "
+                "\"i_in_1\": %s, "
+                "\"v_in_2\": %s, "
+                "\"i_in_2\": %s, "
                 "\"grid_voltage\": %s, "
+                "\"grid_current\": %s, "
+                "\"grid_power\": %s, "
                 "\"grid_frequency\": %s, "
+                "\"isolation_resistance\": %s, "
+                "\"leak_current_dcdc\": %s, "
+                "\"leak_current_inverter\": %s, "
                 "\"temp_inverter\": %s, "
-                "\"temp_booster\": %s"
+                "\"temp_booster\": %s, "
+                "\"inverter_clock_offset\": %s, "
+                "\"inverter_clock_drift_ppm\": %s"
             "}"
         ),
-        now,
-        energyToday,
-        energyLifetime,
-        pvOutputLastUpdate,
-        pvOutputLastPublished,
+        status->lastUpdate,
+        status->energyToday,
+        status->energyTotal,
+        status->lastPvoutputRead,
+        status->lastPvoutputSent,
         pIn_s,
         pIn1_s,
         pIn2_s,
+        vIn1_s,
+        iIn1_s,
+        vIn2_s,
+        iIn2_s,
         vGrid_s,
+        iGrid_s,
+        pGrid_s,
         fGrid_s,
+        rIso_s,
+        iLeakDcDc_s,
+        iLeakInverter_s,
         tempInverter_s,
-        tempBooster_s
+        tempBooster_s,
+        clockOffset_s,
+        clockDrift_s
     );
-    log("%s: Status updated: %s\n", TIME_STR, inverterStatus);
-    if (mqttConnected()) {
-        if (!isnan(pIn)) {
-            mqttSend(mqttTopicPower, pIn_s);
+}
+
+
+#if MQTT_STAT_CBOR
+// Encode status as a CBOR map with the same keys as the JSON status. Floats are sent as float32, NaN included.
+// Returns encoded length, or 0 if buf is too small.
+size_t inverterFormatStatusCbor(const InverterStatus *status, uint8_t *buf, size_t bufLen) {
+    CborWriter cbor(buf, bufLen);
+    cbor.map(23);
+    cbor.text_P(PSTR("last_update"));
+    cbor.uint(status->lastUpdate);
+    cbor.text_P(PSTR("energy_today"));
+    cbor.uint(status->energyToday);
+    cbor.text_P(PSTR("energy_total"));
+    cbor.uint(status->energyTotal);
+    cbor.text_P(PSTR("last_pvoutput_read"));
+    cbor.uint(status->lastPvoutputRead);
+    cbor.text_P(PSTR("last_pvoutput_sent"));
+    cbor.uint(status->lastPvoutputSent);
+    cbor.text_P(PSTR("p_in"));
+    cbor.float32(status->pIn);
+    cbor.text_P(PSTR("p_in_1"));
+    cbor.float32(status->pIn1);
+    cbor.text_P(PSTR("p_in_2"));
+    cbor.float32(status->pIn2);
+    cbor.text_P(PSTR("v_in_1"));
+    cbor.float32(status->vIn1);
+    cbor.text_P(PSTR("i_in_1"));
+    cbor.float32(status->iIn1);
+    cbor.text_P(PSTR("v_in_2"));
+    cbor.float32(status->vIn2);
+    cbor.text_P(PSTR("i_in_2"));
+    cbor.float32(status->iIn2);
+    cbor.text_P(PSTR("grid_voltage"));
+    cbor.float32(status->vGrid);
+    cbor.text_P(PSTR("grid_current"));
+    cbor.float32(status->iGrid);
+    cbor.text_P(PSTR("grid_power"));
+    cbor.float32(status->pGrid);
+    cbor.text_P(PSTR("grid_frequency"));
+    cbor.float32(status->fGrid);
+    cbor.text_P(PSTR("isolation_resistance"));
+    cbor.float32(status->rIso);
+    cbor.text_P(PSTR("leak_current_dcdc"));
+    cbor.float32(status->iLeakDcDc);
+    cbor.text_P(PSTR("leak_current_inverter"));
+    cbor.float32(status->iLeakInverter);
+    cbor.text_P(PSTR("temp_inverter"));
+    cbor.float32(status->tempInverter);
+    cbor.text_P(PSTR("temp_booster"));
+    cbor.float32(status->tempBooster);
+    cbor.text_P(PSTR("inverter_clock_offset"));
+    cbor.float32(status->clockOffset);
+    cbor.text_P(PSTR("inverter_clock_drift_ppm"));
+    cbor.float32(status->clockDriftPpm);
+    return cbor.overflow() ? 0 : cbor.length();
+}
+#endif
+
+
+// Called when an inverter sweep finishes
+void inverterUpdateStatus(Inverter *inv) {
+    unsigned long now = getEpochTime();
+    char pIn_s[20];
+
+    if (!inv->sweep.online()) {
+        logWarn("%s: Can not update inverter %u stats - inverter offline\n", TIME_STR, inv->address);
+        return;
+    }
+    led.flashFast(1);
+    metricsAuroraSweep.observe(inv->sweep.durationUs());
+    debug("%s: Inverter %u sweep took %lu ms, bus utilization %.1f%%\n", TIME_STR, inv->address, inv->sweep.durationUs() / 1000, auroraBusUtilization * 100);
+
+    float pIn1 = inverterSweepDSP(inv, AURORA_DSP_PIN1);
+    float pIn2 = inverterSweepDSP(inv, AURORA_DSP_PIN2);
+    float pIn = NAN;
+    if (!isnan(pIn1) && !isnan(pIn2)) {
+        pIn = pIn1 + pIn2;
+    }
+    inv->power.add(millis(), pIn);
+    if (bootFirstSampleMs == 0 && !isnan(pIn)) {
+        bootFirstSampleMs = millis();
+        log("%s: First sample %lu ms after boot\n", TIME_STR, bootFirstSampleMs);
+    }
+
+    inv->status = {
+        now,
+        inverterSweepEnergy(inv, AURORA_ENERGY_DAILY),
+        inverterSweepEnergy(inv, AURORA_ENERGY_LIFETIME),
+        inv->pvOutputLastUpdate,
+        inv->pvOutputLastPublished,
+        pIn,
+        pIn1,
+        pIn2,
+        inverterSweepDSP(inv, AURORA_DSP_INPUT1_VOLTAGE),
+        inverterSweepDSP(inv, AURORA_DSP_INPUT1_CURRENT),
+        inverterSweepDSP(inv, AURORA_DSP_INPUT2_VOLTAGE),
+        inverterSweepDSP(inv, AURORA_DSP_INPUT2_CURRENT),
+        inverterSweepDSP(inv, AURORA_DSP_GRID_VOLTAGE),
+        inverterSweepDSP(inv, AURORA_DSP_GRID_CURRENT),
+        inverterSweepDSP(inv, AURORA_DSP_GRID_POWER),
+        inverterSweepDSP(inv, AURORA_DSP_FREQUENCY),
+        inverterSweepDSP(inv, AURORA_DSP_ISOLATION),
+        inverterSweepDSP(inv, AURORA_DSP_ILEAK_DCDC),
+        inverterSweepDSP(inv, AURORA_DSP_ILEAK_INVERTER),
+        inverterSweepDSP(inv, AURORA_DSP_INVERTER_TEMP),
+        inverterSweepDSP(inv, AURORA_DSP_BOOSTER_TEMP),
+        inv->clock.valid() ? inv->clock.predict(now) : NAN,
+        inv->clock.driftValid() ? inv->clock.driftPpm() : NAN
+    };
+    // Format last status
+    inverterFormatStatusJson(&inv->status, inverterStatusJson, sizeof(inverterStatusJson));
+    stateSave();
+    // Full status does not fit a log record. Log a summary, full status at debug level is truncated
+    log("%s: Inverter %u status updated: p_in=%s\n", TIME_STR, inv->address, _formatFloat(pIn_s, sizeof(pIn_s), pIn));
+    debug("%s: Inverter %u status updated: %s\n", TIME_STR, inv->address, inverterStatusJson);
+    // Published from loop() within the publish budget. A status still waiting is replaced by this one
+    inv->statusPending = true;
+}
+
+
+void inverterPublishStatus(Inverter *inv) {
+    char pIn_s[20];
+    inv->statusPending = false;
+    if (!isnan(inv->status.pIn)) {
+        mqttSend(mqttTopicPower, _formatFloat(pIn_s, sizeof(pIn_s), inv->status.pIn), inv->address);
+    }
+    inverterFormatStatusJson(&inv->status, inverterStatusJson, sizeof(inverterStatusJson));
+    mqttSend(mqttTopicStat, inverterStatusJson, inv->address);
+#if MQTT_STAT_CBOR
+    if (mqttStatCbor) {
+        uint8_t statusCbor[512];
+        size_t statusCborLen = inverterFormatStatusCbor(&inv->status, statusCbor, sizeof(statusCbor));
+        debug("CBOR status: %u bytes (JSON %u bytes)\n", (unsigned)statusCborLen, (unsigned)strlen(inverterStatusJson));
+        if (statusCborLen > 0) {
+            mqttSendBinary(mqttTopicStatCbor, statusCbor, statusCborLen, inv->address);
         }
-        mqttSend(mqttTopicStat, inverterStatus);
     }
+#endif
 }
 
 
@@ -505,65 +1981,719 @@ void inverterUpdateStatus() {
 // PV Output Functions
 
 
-bool pvOutputSend() {
-    unsigned long timeLocal = toLocalTime(pvOutputLastUpdate);
-    log("%s: Sending to PV Output: %lu = %lu\n", TIME_STR, timeLocal, pvOutputEnergyToday);
+// POST form data to PVOutput for one system. Returns the HTTP code, negative for client errors
+int pvOutputPost(PGM_P urlP, const char *sid, const char *postData) {
+    String url(FPSTR(urlP));
+    log("%s: Posting to %s: %s\n", TIME_STR, url.c_str(), postData);
+    HTTPClient &http = pvOutputHttp;
+    // Reuse the connection of the last upload if the server kept it and is likely to still hold it
+    if (wifiClientSecure.connected() && millis() - pvOutputIdleSinceMs < PVOUTPUT_KEEPALIVE_MS) {
+        metricsPvOutputReused++;
+    } else {
+        wifiClientSecure.stop();
+    }
+    if (!http.begin(wifiClientSecure, url)) {
+        logError("%s: http begin failed\n", TIME_STR);
+        return HTTPC_ERROR_CONNECTION_FAILED;
+    }
+    http.addHeader(F("Content-Type"), F("application/x-www-form-urlencoded"));
+    http.addHeader(F("X-Pvoutput-Apikey"), pvoutputApiKey);
+    http.addHeader(F("X-Pvoutput-SystemId"), sid);
+    unsigned long tStart = micros();
+    int httpCode;
+    {
+        LoopStage stage(STAGE_PVOUTPUT_POST);
+        httpCode = http.POST((uint8_t*)postData, strlen(postData));
+    }
+    metricsPvOutputUpload.observeSince(tStart);
+    flightRecorder.record(FR_EVENT_HTTP, 0, (uint16_t)httpCode);
+    if (httpCode > 0) {
+        log("%s: PV Output update returned %d\n", TIME_STR, httpCode);
+        log("%s\n", http.getString().c_str());
+        mqttLog("PV Output update (%s) returned %d\n", postData, httpCode);
+    } else {
+        logError("%s: PV Output update error: %s\n", TIME_STR, http.errorToString(httpCode).c_str());
+        mqttLog("PV Output update (%s) error %s\n", postData, http.errorToString(httpCode).c_str());
+    }
+    // Keeps the connection open if the server allowed it
+    http.end();
+    pvOutputIdleSinceMs = millis();
+    if (httpCode == 200) {
+        metricsPvOutputOk++;
+    } else {
+        metricsPvOutputFailed++;
+    }
+    return httpCode;
+}
+
+
+bool pvOutputSend(Inverter *inv) {
+    unsigned long timeLocal = toLocalTime(inv->pvOutputLastUpdate);
+    log("%s: Sending inverter %u to PV Output: %lu = %lu\n", TIME_STR, inv->address, timeLocal, inv->pvOutputEnergyToday);
     char post_data[512] = {0};
-    snprintf(post_data, sizeof(post_data),
-        (
+    snprintf_P(post_data, sizeof(post_data),
+        PSTR(
             "d=%04d%02d%02d&"
             "t=%02d:%02d&"
             "v1=%lu&c1=0&v2=%.2f"
         ),
         year(timeLocal), month(timeLocal), day(timeLocal),
         hour(timeLocal), minute(timeLocal),
-        pvOutputEnergyToday, pvOutputPower
+        inv->pvOutputEnergyToday, inv->pvOutputPower
     );
-    log("%s: Posting to %s: %s\n", TIME_STR, pvoutputAddStatsUrl, post_data);
-    HTTPClient http;
-    http.setReuse(false);
-    if (!http.begin(wifiClientSecure, pvoutputAddStatsUrl)) {
-        log("%s: http begin failed\n", TIME_STR);
+    unsigned long tStart = micros();
+    int httpCode = pvOutputPost(pvoutputAddStatsUrl, inv->pvOutputSid, post_data);
+    netScheduler.spendSince(netSinkPvOutput, tStart);
+    if (httpCode != 200) {
         return false;
     }
-    http.addHeader("Content-Type", "application/x-www-form-urlencoded");
-    http.addHeader("X-Pvoutput-Apikey", pvoutputApiKey);
-    http.addHeader("X-Pvoutput-SystemId", pvoutputApiSID);
-    int httpCode = http.POST((uint8_t*)post_data, strlen(post_data));
-    if (httpCode > 0) {
-        log("%s: PV Output update returned %d\n", TIME_STR, httpCode);
-        log("%s\n", http.getString().c_str());
-        mqttLog("PV Output update (%s) returned %d\n", post_data, httpCode);
-    } else {
-        log("%s: PV Output update error: %s\n", TIME_STR, http.errorToString(httpCode).c_str());
-        mqttLog("PV Output update (%s) error %s\n", post_data, http.errorToString(httpCode).c_str());
+    inv->pvOutputLastPublished = getEpochTime();
+    stateSave();
+    return true;
+}
+
+
+bool pvOutputBacklogged(uint8_t address) {
+    for (uint8_t i = 0; i < pvOutputBacklog.count(); i++) {
+        if (pvOutputBacklog.reading(i)->address == address) {
+            return true;
+        }
     }
-    http.end();
-    if (httpCode == 200) {
-        pvOutputLastPublished = getEpochTime();
+    return false;
+}
+
+
+// Longest reading in a batch: ";yyyymmdd,hh:mm," then up to 10 energy digits, "," and a power under 1e9 W with sign
+#define PVOUTPUT_BATCH_ENTRY_MAX (16 + 10 + 1 + 10)
+
+// Upload the oldest backlog readings of one inverter with addbatchstatus, up to PVOUTPUT_BATCH_MAX. Returns false
+// if they are still held
+bool pvOutputSendBatch(Inverter *inv) {
+    char post_data[5 + PVOUTPUT_BATCH_MAX * PVOUTPUT_BATCH_ENTRY_MAX + 1];
+    uint8_t n = 0;
+    size_t pos = _appendf_P(post_data, sizeof(post_data), 0, PSTR("data="));
+    for (uint8_t i = 0; i < pvOutputBacklog.count() && n < PVOUTPUT_BATCH_MAX; i++) {
+        const PvOutputBacklog::Reading *r = pvOutputBacklog.reading(i);
+        if (r->address != inv->address) {
+            continue;
+        }
+        if (sizeof(post_data) - pos <= PVOUTPUT_BATCH_ENTRY_MAX) {
+            // Readings are removed by count, so never send one cut short
+            break;
+        }
+        unsigned long timeLocal = toLocalTime(r->time);
+        pos = _appendf_P(post_data, sizeof(post_data), pos, PSTR("%S%04d%02d%02d,%02d:%02d,%lu,"),
+            n > 0 ? PSTR(";") : PSTR(""),
+            year(timeLocal), month(timeLocal), day(timeLocal),
+            hour(timeLocal), minute(timeLocal),
+            r->energy
+        );
+        if (fabs(r->power) < 1e9) {
+            pos = _appendf_P(post_data, sizeof(post_data), pos, PSTR("%.0f"), r->power);
+        }
+        n++;
+    }
+    if (n == 0) {
         return true;
     }
-    return false;
+    log("%s: Sending %u backlog readings of inverter %u to PV Output\n", TIME_STR, n, inv->address);
+    int httpCode = pvOutputPost(pvoutputAddBatchUrl, inv->pvOutputSid, post_data);
+    if (httpCode == 400) {
+        // The data itself was refused, e.g. older than PVOutput accepts. Retrying would hold up every later reading
+        logWarn("%s: PV Output rejected %u backlog readings of inverter %u\n", TIME_STR, n, inv->address);
+    } else if (httpCode != 200) {
+        // 401 bad key, 403 hourly request limit, 429, 5xx or no connection: keep the readings and retry later
+        logWarn("%s: PV Output batch of inverter %u failed with HTTP %d, keeping %u readings\n", TIME_STR, inv->address, httpCode, n);
+        return false;
+    }
+    pvOutputBacklog.remove(inv->address, n);
+    return true;
+}
+
+
+// Bulk sink: replay the backlog one batch per turn, starting with the inverter of the oldest reading
+void pvOutputReplayPoll() {
+    if (pvOutputBacklog.count() == 0 || !isWifiConnected()) {
+        return;
+    }
+    if (pvOutputReplayHeld && millis() - pvOutputReplayHeldMs < PVOUTPUT_REPLAY_RETRY * 1000UL) {
+        return;
+    }
+    if (!netScheduler.allow(netSinkBulk)) {
+        return;
+    }
+    uint8_t address = pvOutputBacklog.reading(0)->address;
+    Inverter *inv = NULL;
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        if (inverters[i].address == address && inverters[i].pvOutputSid != NULL) {
+            inv = &inverters[i];
+        }
+    }
+    if (inv == NULL) {
+        // No longer polled after a bus scan
+        logWarn("%s: Dropping PV Output backlog of inverter %u\n", TIME_STR, address);
+        pvOutputBacklog.remove(address, PVOUTPUT_BACKLOG_SIZE);
+        return;
+    }
+    unsigned long tStart = micros();
+    pvOutputReplayHeld = !pvOutputSendBatch(inv);
+    netScheduler.spendSince(netSinkBulk, tStart);
+    if (pvOutputReplayHeld) {
+        pvOutputReplayHeldMs = millis();
+    }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// State persistence
+
+
+#define STATE_VERSION 4
+
+// Per inverter part of SavedState
+struct SavedInverter {
+    uint32_t address;
+    unsigned long pvOutputEnergyToday;
+    float pvOutputPower;
+    unsigned long pvOutputLastUpdate;
+    unsigned long pvOutputLastPublished;
+    InverterStatus status;
+};
+
+// Saved to RTC memory on every update, restored after a reset. Copied to flash every STATE_FLASH_PERIOD for power loss.
+// RTC memory holds the header and as many inverters as fit, flash holds all of them. Unused entries have address 0.
+// Bump STATE_VERSION when the layout changes, older blocks are then ignored.
+struct SavedState {
+    uint32_t crc;
+    uint16_t version;
+    uint16_t size;
+    unsigned long savedAt;
+    SavedInverter inverters[INVERTER_MAX];
+};
+
+#define STATE_HEADER_SIZE offsetof(SavedState, inverters)
+#define STATE_RTC_INVERTERS min((size_t)INVERTER_MAX, (RTC_BLOCKS_STATE * 4 - STATE_HEADER_SIZE) / sizeof(SavedInverter))
+#define STATE_RTC_SIZE (STATE_HEADER_SIZE + STATE_RTC_INVERTERS * sizeof(SavedInverter))
+
+static_assert(STATE_HEADER_SIZE + sizeof(SavedInverter) <= RTC_BLOCKS_STATE * 4, "SavedState does not fit its RTC blocks");
+static_assert(sizeof(SavedInverter) % 4 == 0 && STATE_HEADER_SIZE % 4 == 0, "SavedState size must be a multiple of 4");
+
+unsigned long stateFlashSavedAt = 0;
+
+
+static bool stateValid(const SavedState *state) {
+    return state->version == STATE_VERSION && state->size == sizeof(SavedState)
+        && state->crc == crc32(&state->version, sizeof(SavedState) - sizeof(state->crc));
+}
+
+
+static const SavedInverter *stateFind(const SavedState *state, uint8_t count, uint8_t address) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (state->inverters[i].address == address) {
+            return &state->inverters[i];
+        }
+    }
+    return NULL;
+}
+
+
+void stateRestore() {
+    // The flash copy is read in place from the EEPROM buffer, the RTC part is small enough for the stack
+    EEPROM.begin(sizeof(SavedState));
+    const SavedState *flash = (const SavedState *)EEPROM.getConstDataPtr();
+    bool flashOk = stateValid(flash);
+    uint32_t rtcBlocks[RTC_BLOCKS_STATE];
+    const SavedState *rtc = (const SavedState *)rtcBlocks;
+    bool rtcOk = rtcLoad(RTC_BLOCK_STATE, rtcBlocks, STATE_RTC_SIZE) && rtc->version == STATE_VERSION
+        && rtc->size == sizeof(SavedState);
+    if (!rtcOk && !flashOk) {
+        log("State: nothing to restore\n");
+        return;
+    }
+    stateFlashSavedAt = flashOk ? flash->savedAt : rtc->savedAt;
+
+    unsigned long now = getEpochTime();
+    bool catchUp = false;
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        Inverter *inv = &inverters[i];
+        // RTC is newer, flash fills in the inverters that do not fit RTC memory
+        const SavedState *state = rtc;
+        const SavedInverter *saved = rtcOk ? stateFind(rtc, STATE_RTC_INVERTERS, inv->address) : NULL;
+        if (saved == NULL && flashOk) {
+            state = flash;
+            saved = stateFind(flash, INVERTER_MAX, inv->address);
+        }
+        if (saved == NULL) {
+            continue;
+        }
+        inv->pvOutputEnergyToday = saved->pvOutputEnergyToday;
+        inv->pvOutputPower = saved->pvOutputPower;
+        inv->pvOutputLastUpdate = saved->pvOutputLastUpdate;
+        inv->pvOutputLastPublished = saved->pvOutputLastPublished;
+        inv->status = saved->status;
+        log("State: inverter %u restored from %S, saved at %lu, last published %lu\n", inv->address,
+            state == rtc ? PSTR("RTC") : PSTR("flash"), state->savedAt, inv->pvOutputLastPublished);
+        // Upload now if the reset made us miss the current PVOutput slot, rather than waiting for the next one
+        if (now != 0 && inv->pvOutputLastPublished != 0 && inv->pvOutputLastPublished < now - now % UPDATE_PERIOD_PVOUTPUT) {
+            catchUp = true;
+        }
+    }
+    if (catchUp) {
+        log("State: PV Output slot missed, catching up\n");
+        scheduler.runSoon(taskIdPvOutput);
+    }
+}
+
+
+// Cheap, called after every update. Flash is written at most every STATE_FLASH_PERIOD and only with new data.
+// The state is built in the EEPROM buffer to keep it off the stack
+void stateSave() {
+    SavedState *state = (SavedState *)EEPROM.getDataPtr();
+    memset(state, 0, sizeof(SavedState));
+    state->version = STATE_VERSION;
+    state->size = sizeof(SavedState);
+    state->savedAt = getEpochTime();
+    unsigned long lastPublished = 0;
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        const Inverter *inv = &inverters[i];
+        SavedInverter *saved = &state->inverters[i];
+        saved->address = inv->address;
+        saved->pvOutputEnergyToday = inv->pvOutputEnergyToday;
+        saved->pvOutputPower = inv->pvOutputPower;
+        saved->pvOutputLastUpdate = inv->pvOutputLastUpdate;
+        saved->pvOutputLastPublished = inv->pvOutputLastPublished;
+        saved->status = inv->status;
+        lastPublished = max(lastPublished, inv->pvOutputLastPublished);
+    }
+    rtcStore(RTC_BLOCK_STATE, state, STATE_RTC_SIZE);
+
+    static unsigned long flashPublished = 0;
+    if (state->savedAt == 0 || lastPublished == flashPublished
+            || state->savedAt - stateFlashSavedAt < STATE_FLASH_PERIOD) {
+        return;
+    }
+    state->crc = crc32(&state->version, sizeof(SavedState) - sizeof(state->crc));
+    if (EEPROM.commit()) {
+        stateFlashSavedAt = state->savedAt;
+        flashPublished = lastPublished;
+        debug("State: saved to flash\n");
+    } else {
+        logError("State: flash write failed\n");
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory report
+
+
+// Linker symbols bounding the DRAM segments. rodata includes any constant not moved to flash with PROGMEM
+extern "C" char _data_start[], _data_end[], _rodata_start[], _rodata_end[], _bss_start[], _bss_end[];
+
+
+// Report heap state and statically allocated DRAM per subsystem as JSON. Add new subsystems to "static"
+size_t memoryReport(char *buf, size_t bufLen) {
+    size_t pos = 0;
+    pos = _appendf_P(buf, bufLen, pos,
+        PSTR("{\"free_heap\": %u, \"max_free_block\": %u, \"heap_fragmentation\": %u, \"data\": %u, \"rodata\": %u, \"bss\": %u, \"static\": {"),
+        (unsigned)ESP.getFreeHeap(),
+        (unsigned)ESP.getMaxFreeBlockSize(),
+        (unsigned)ESP.getHeapFragmentation(),
+        (unsigned)(_data_end - _data_start),
+        (unsigned)(_rodata_end - _rodata_start),
+        (unsigned)(_bss_end - _bss_start)
+    );
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"log\": %u, "), (unsigned)sizeof(logRing));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"status\": %u, "), (unsigned)sizeof(inverterStatusJson));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"inverter\": %u, "), (unsigned)(sizeof(auroraLink) + sizeof(auroraSerial) + sizeof(inverters) + sizeof(inverterScan)));
+#if GRID_CAPTURE
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"grid\": %u, "), (unsigned)(sizeof(gridSweep) + sizeof(gridCapture)));
+#endif
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"mqtt\": %u, "), (unsigned)(sizeof(pubSubClient) + sizeof(wifiClient) + sizeof(_mqttTopic)));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"pvoutput\": %u, "), (unsigned)(sizeof(wifiClientSecure) + sizeof(pvOutputHttp) + sizeof(pvOutputTlsSession) + sizeof(pvOutputBacklog)));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"ntp\": %u, "), (unsigned)(sizeof(sntpClient) + sizeof(wallClock)));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"dns\": %u, "), (unsigned)sizeof(dnsCache));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"net\": %u, "), (unsigned)sizeof(netScheduler));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"web\": %u, "), (unsigned)sizeof(webServer));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"metrics\": %u, "), (unsigned)(sizeof(metricsAuroraLatency) + sizeof(metricsAuroraFailures) + sizeof(metricsAuroraResults) + sizeof(metricsLoop) + sizeof(metricsLoopHandler) + sizeof(metricsPvOutputUpload) + sizeof(metricsAuroraSweep) + sizeof(metricsNetConnect) + sizeof(metricsNetConnectFailed)));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"stalls\": %u, "), (unsigned)sizeof(stallDetector));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"recorder\": %u, "), (unsigned)sizeof(flightRecorder));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"scheduler\": %u, "), (unsigned)sizeof(scheduler));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"power\": %u, "), (unsigned)sizeof(powerSave));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("\"led\": %u"), (unsigned)sizeof(led));
+    pos = _appendf_P(buf, bufLen, pos, PSTR("}}"));
+    return pos;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stall report
+
+
+size_t formatStall(const StallDetector::Stall *stall, char *buf, size_t bufLen) {
+    char stageName[24];
+    strncpy_P(stageName, StallDetector::stageName(stall->stage), sizeof(stageName)-1);
+    stageName[sizeof(stageName)-1] = 0;
+    return _appendf_P(buf, bufLen, 0,
+        PSTR("{\"time\": %lu, \"duration_ms\": %lu, \"stage\": \"%s\", \"stage_ms\": %lu}"),
+        (unsigned long)stall->time, (unsigned long)stall->durationMs, stageName, (unsigned long)stall->stageMs
+    );
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Flight recorder
+
+
+// Record connectivity changes, heap low-water marks and uptime. Dump recovered events to MQTT LOG once connected
+void flightRecorderPoll() {
+    static bool wifiWasConnected = false;
+    static bool mqttWasConnected = false;
+    static uint32_t heapLowWater = 0xffffffff;
+    static unsigned long uptimeMinutes = 0;
+    static uint8_t dumpNext = 0;
+
+    bool wifiNow = isWifiConnected();
+    if (wifiNow != wifiWasConnected) {
+        flightRecorder.record(FR_EVENT_WIFI, wifiNow, wifiNow ? 0 : wifiDisconnectReason);
+        wifiWasConnected = wifiNow;
+    }
+    bool mqttNow = mqttConnected();
+    if (mqttNow != mqttWasConnected) {
+        flightRecorder.record(FR_EVENT_MQTT, mqttNow, pubSubClient.state());
+        mqttWasConnected = mqttNow;
+    }
+    uint32_t heap = ESP.getFreeHeap();
+    if (heap + FLIGHT_RECORDER_HEAP_STEP <= heapLowWater) {
+        flightRecorder.record(FR_EVENT_HEAP, 0, min(heap, (uint32_t)0xffff));
+        heapLowWater = heap;
+    }
+    if (millis() / 60000 != uptimeMinutes) {
+        uptimeMinutes = millis() / 60000;
+        flightRecorder.record(FR_EVENT_UPTIME, 0, min(uptimeMinutes, 0xffffUL));
+    }
+
+    // One line per loop, only when the log ring is empty so the dump is not dropped, and within the bulk budget
+    if (mqttNow && dumpNext < flightRecorder.dumpCount() && logRing.pending() == 0 && netScheduler.allow(netSinkBulk)) {
+        char line[128];
+        size_t pos = _appendf_P(line, sizeof(line), 0, PSTR("Flight recorder %u:"), dumpNext);
+        for (uint8_t i = 0; i < 8 && dumpNext < flightRecorder.dumpCount(); i++, dumpNext++) {
+            const FlightRecorder::Event *event = flightRecorder.dumpEvent(dumpNext);
+            char typeName[12];
+            strncpy_P(typeName, FlightRecorder::typeName(event->type), sizeof(typeName)-1);
+            typeName[sizeof(typeName)-1] = 0;
+            pos = _appendf_P(line, sizeof(line), pos, PSTR(" %s/%u/%u"), typeName, event->arg, event->value);
+        }
+        mqttLog("%s", line);
+    }
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // HTTP Server Handlers
 
 
 void webHandle404() {
-    webServer.send(404, "text/html", "Not Found\r\n");
+    webServer.send_P(404, PSTR("text/html"), PSTR("Not Found\r\n"));
+}
+
+
+void webSendInverterStatus(const Inverter *inv) {
+    if (webServer.method() != HTTP_GET || inv == NULL) {
+        webHandle404();
+        return;
+    }
+    log("Web request received: %s %d %s\n", webServer.client().remoteIP().toString().c_str(), webServer.method(), webServer.uri().c_str());
+    inverterFormatStatusJson(&inv->status, inverterStatusJson, sizeof(inverterStatusJson));
+    webServer.send(200, "application/json", inverterStatusJson);
 }
 
 
-// Serve inverterStatus
+// Serve the status of the first inverter
 void webHandleRoot() {
+    webSendInverterStatus(&inverters[0]);
+}
+
+
+// Serve /inverter/<address>
+void webHandleInverter() {
+    int address = webServer.pathArg(0).toInt();
+    const Inverter *inv = NULL;
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        if (inverters[i].address == address) {
+            inv = &inverters[i];
+        }
+    }
+    webSendInverterStatus(inv);
+}
+
+
+// GET: last bus scan result. POST: start a scan, poll with GET for the result
+void webHandleScan() {
+    char scanJson[128];
+    if (webServer.method() == HTTP_POST) {
+        inverterScanStart();
+        inverterFormatScanJson(scanJson, sizeof(scanJson));
+        webServer.send(202, "application/json", scanJson);
+        return;
+    }
+    inverterFormatScanJson(scanJson, sizeof(scanJson));
+    webServer.send(200, "application/json", scanJson);
+}
+
+
+// Serve memory report
+void webHandleMemory() {
     if (webServer.method() != HTTP_GET) {
         webHandle404();
         return;
     }
-    log("Web request received: %s %d %s\n", webServer.client().remoteIP().toString().c_str(), webServer.method(), webServer.uri().c_str());
-    webServer.send(200, "application/json", inverterStatus);
+    char report[512];
+    memoryReport(report, sizeof(report));
+    webServer.send(200, "application/json", report);
+}
+
+
+void webMetricsFlush(const char *buf, size_t len) {
+    webServer.sendContent(buf, len);
+}
+
+
+// Serve metrics in Prometheus text format
+void webHandleMetrics() {
+    if (webServer.method() != HTTP_GET) {
+        webHandle404();
+        return;
+    }
+    webServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    webServer.send(200, "text/plain; version=0.0.4", "");
+    MetricsWriter out(webMetricsFlush);
+
+    out.header(PSTR("aurora_transport_info"), PSTR("gauge"), PSTR("Inverter link transport, to compare failure rate and latency between builds"));
+#if AURORA_HW_SERIAL
+    out.gauge(PSTR("aurora_transport_info"), PSTR("transport=\"uart\""), 1);
+#else
+    out.gauge(PSTR("aurora_transport_info"), PSTR("transport=\"softserial\""), 1);
+#endif
+    out.header(PSTR("aurora_request_duration_seconds"), PSTR("histogram"), PSTR("Inverter request latency"));
+    out.histogram(PSTR("aurora_request_duration_seconds"), PSTR("command=\"state\""), &metricsAuroraLatency[AURORA_CMD_STATE]);
+    out.histogram(PSTR("aurora_request_duration_seconds"), PSTR("command=\"dsp\""), &metricsAuroraLatency[AURORA_CMD_DSP]);
+    out.histogram(PSTR("aurora_request_duration_seconds"), PSTR("command=\"cumulated_energy\""), &metricsAuroraLatency[AURORA_CMD_CUMULATED_ENERGY]);
+    out.histogram(PSTR("aurora_request_duration_seconds"), PSTR("command=\"time_read\""), &metricsAuroraLatency[AURORA_CMD_TIME_READ]);
+    out.histogram(PSTR("aurora_request_duration_seconds"), PSTR("command=\"time_write\""), &metricsAuroraLatency[AURORA_CMD_TIME_WRITE]);
+    out.header(PSTR("aurora_sweep_duration_seconds"), PSTR("histogram"), PSTR("Inverter status sweep duration"));
+    out.histogram(PSTR("aurora_sweep_duration_seconds"), PSTR(""), &metricsAuroraSweep);
+    out.header(PSTR("aurora_sweeps_total"), PSTR("counter"), PSTR("Inverter status sweeps"));
+    uint32_t sweeps = 0;
+    uint32_t sweepsAborted = 0;
+    for (uint8_t i = 0; i < inverterCount; i++) {
+        sweeps += inverters[i].sweep.sweeps();
+        sweepsAborted += inverters[i].sweep.aborted();
+    }
+    out.counter(PSTR("aurora_sweeps_total"), PSTR("result=\"complete\""), sweeps);
+    out.counter(PSTR("aurora_sweeps_total"), PSTR("result=\"offline\""), sweepsAborted);
+    out.header(PSTR("aurora_bus_utilization"), PSTR("gauge"), PSTR("Fraction of time the inverter bus was busy between the last two sweep rounds"));
+    out.gauge(PSTR("aurora_bus_utilization"), PSTR(""), auroraBusUtilization);
+    out.header(PSTR("aurora_scans_total"), PSTR("counter"), PSTR("Inverter bus scans"));
+    out.counter(PSTR("aurora_scans_total"), PSTR(""), inverterScan.scans());
+    out.header(PSTR("aurora_scan_duration_seconds"), PSTR("gauge"), PSTR("Duration of the last inverter bus scan"));
+    out.gauge(PSTR("aurora_scan_duration_seconds"), PSTR(""), inverterScan.durationUs() / 1e6);
+    out.header(PSTR("aurora_scan_responders"), PSTR("gauge"), PSTR("Inverters that answered the last bus scan"));
+    out.gauge(PSTR("aurora_scan_responders"), PSTR(""), inverterScan.count());
+    out.header(PSTR("inverters"), PSTR("gauge"), PSTR("Inverters polled"));
+    out.gauge(PSTR("inverters"), PSTR(""), inverterCount);
+#if GRID_CAPTURE
+    out.header(PSTR("grid_samples_total"), PSTR("counter"), PSTR("Grid voltage and frequency burst samples"));
+    out.counter(PSTR("grid_samples_total"), PSTR(""), gridCapture.samples());
+    out.header(PSTR("grid_events_total"), PSTR("counter"), PSTR("Grid excursions captured"));
+    out.counter(PSTR("grid_events_total"), PSTR(""), gridCapture.events());
+#endif
+    out.header(PSTR("aurora_bus_busy_seconds_total"), PSTR("counter"), PSTR("Time the inverter bus was busy with requests"));
+    out.counterUs(PSTR("aurora_bus_busy_seconds_total"), PSTR(""), auroraLink.busyUs());
+    out.header(PSTR("aurora_request_results_total"), PSTR("counter"), PSTR("Inverter requests by outcome"));
+    out.counter(PSTR("aurora_request_results_total"), PSTR("result=\"ok\""), metricsAuroraResults[AURORA_OK]);
+    out.counter(PSTR("aurora_request_results_total"), PSTR("result=\"timeout\""), metricsAuroraResults[AURORA_TIMEOUT]);
+    out.counter(PSTR("aurora_request_results_total"), PSTR("result=\"bad_crc\""), metricsAuroraResults[AURORA_BAD_CRC]);
+    out.counter(PSTR("aurora_request_results_total"), PSTR("result=\"refused\""), metricsAuroraResults[AURORA_REFUSED]);
+    out.counter(PSTR("aurora_request_results_total"), PSTR("result=\"bad_frame\""), metricsAuroraResults[AURORA_BAD_FRAME]);
+    out.header(PSTR("aurora_retries_total"), PSTR("counter"), PSTR("Inverter requests resent after a transient failure"));
+    out.counter(PSTR("aurora_retries_total"), PSTR(""), auroraLink.retries());
+    out.header(PSTR("aurora_timeouts_total"), PSTR("counter"), PSTR("Inverter reply timeouts, including retried ones"));
+    out.counter(PSTR("aurora_timeouts_total"), PSTR(""), auroraLink.timeouts());
+    out.header(PSTR("aurora_timeout_seconds"), PSTR("gauge"), PSTR("Adaptive inverter reply timeout"));
+    out.gauge(PSTR("aurora_timeout_seconds"), PSTR("command=\"state\""), auroraLink.timeoutUs(AURORA_OP_STATE) / 1e6);
+    out.gauge(PSTR("aurora_timeout_seconds"), PSTR("command=\"dsp\""), auroraLink.timeoutUs(AURORA_OP_DSP) / 1e6);
+    out.gauge(PSTR("aurora_timeout_seconds"), PSTR("command=\"cumulated_energy\""), auroraLink.timeoutUs(AURORA_OP_CUMULATED) / 1e6);
+    out.gauge(PSTR("aurora_timeout_seconds"), PSTR("command=\"time_read\""), auroraLink.timeoutUs(AURORA_OP_TIME_READ) / 1e6);
+    out.gauge(PSTR("aurora_timeout_seconds"), PSTR("command=\"time_write\""), auroraLink.timeoutUs(AURORA_OP_TIME_WRITE) / 1e6);
+    out.header(PSTR("aurora_request_failures_total"), PSTR("counter"), PSTR("Failed inverter requests"));
+    out.counter(PSTR("aurora_request_failures_total"), PSTR("command=\"state\""), metricsAuroraFailures[AURORA_CMD_STATE]);
+    out.counter(PSTR("aurora_request_failures_total"), PSTR("command=\"dsp\""), metricsAuroraFailures[AURORA_CMD_DSP]);
+    out.counter(PSTR("aurora_request_failures_total"), PSTR("command=\"cumulated_energy\""), metricsAuroraFailures[AURORA_CMD_CUMULATED_ENERGY]);
+    out.counter(PSTR("aurora_request_failures_total"), PSTR("command=\"time_read\""), metricsAuroraFailures[AURORA_CMD_TIME_READ]);
+    out.counter(PSTR("aurora_request_failures_total"), PSTR("command=\"time_write\""), metricsAuroraFailures[AURORA_CMD_TIME_WRITE]);
+
+    out.header(PSTR("loop_duration_seconds"), PSTR("histogram"), PSTR("loop() iteration time"));
+    out.histogram(PSTR("loop_duration_seconds"), PSTR(""), &metricsLoop);
+    out.header(PSTR("loop_handler_duration_seconds"), PSTR("histogram"), PSTR("runLoopHandlers() handler time"));
+    out.histogram(PSTR("loop_handler_duration_seconds"), PSTR("handler=\"log\""), &metricsLoopHandler[LOOP_HANDLER_LOG]);
+    out.histogram(PSTR("loop_handler_duration_seconds"), PSTR("handler=\"mqtt\""), &metricsLoopHandler[LOOP_HANDLER_MQTT]);
+    out.histogram(PSTR("loop_handler_duration_seconds"), PSTR("handler=\"ntp\""), &metricsLoopHandler[LOOP_HANDLER_NTP]);
+    out.histogram(PSTR("loop_handler_duration_seconds"), PSTR("handler=\"web\""), &metricsLoopHandler[LOOP_HANDLER_WEB]);
+    out.histogram(PSTR("loop_handler_duration_seconds"), PSTR("handler=\"led\""), &metricsLoopHandler[LOOP_HANDLER_LED]);
+    out.histogram(PSTR("loop_handler_duration_seconds"), PSTR("handler=\"inverter\""), &metricsLoopHandler[LOOP_HANDLER_INVERTER]);
+
+    out.header(PSTR("pvoutput_upload_duration_seconds"), PSTR("histogram"), PSTR("PVOutput POST time including connect"));
+    out.histogram(PSTR("pvoutput_upload_duration_seconds"), PSTR(""), &metricsPvOutputUpload);
+    out.header(PSTR("net_connect_duration_seconds"), PSTR("histogram"), PSTR("TCP connect, and TLS handshake for PVOutput, by destination"));
+    out.histogram(PSTR("net_connect_duration_seconds"), PSTR("destination=\"pvoutput\""), &metricsNetConnect[NET_DEST_PVOUTPUT]);
+    out.histogram(PSTR("net_connect_duration_seconds"), PSTR("destination=\"mqtt\""), &metricsNetConnect[NET_DEST_MQTT]);
+    out.header(PSTR("net_connect_failures_total"), PSTR("counter"), PSTR("Failed connects including failed lookups, by destination"));
+    out.counter(PSTR("net_connect_failures_total"), PSTR("destination=\"pvoutput\""), metricsNetConnectFailed[NET_DEST_PVOUTPUT]);
+    out.counter(PSTR("net_connect_failures_total"), PSTR("destination=\"mqtt\""), metricsNetConnectFailed[NET_DEST_MQTT]);
+    out.header(PSTR("dns_lookups_total"), PSTR("counter"), PSTR("Host name lookups by how they were answered"));
+    out.counter(PSTR("dns_lookups_total"), PSTR("result=\"cached\""), dnsCache.results(DNS_RESULT_CACHED));
+    out.counter(PSTR("dns_lookups_total"), PSTR("result=\"resolved\""), dnsCache.results(DNS_RESULT_RESOLVED));
+    out.counter(PSTR("dns_lookups_total"), PSTR("result=\"stale\""), dnsCache.results(DNS_RESULT_STALE));
+    out.counter(PSTR("dns_lookups_total"), PSTR("result=\"failed\""), dnsCache.results(DNS_RESULT_FAILED));
+    out.counter(PSTR("dns_lookups_total"), PSTR("result=\"literal\""), dnsCache.results(DNS_RESULT_LITERAL));
+    out.header(PSTR("pvoutput_connection_reuses_total"), PSTR("counter"), PSTR("PVOutput uploads on a kept-alive connection"));
+    out.counter(PSTR("pvoutput_connection_reuses_total"), PSTR(""), metricsPvOutputReused);
+    out.header(PSTR("net_sink_busy_seconds_total"), PSTR("counter"), PSTR("Loop time spent on network work by sink"));
+    out.counterUs(PSTR("net_sink_busy_seconds_total"), PSTR("sink=\"web\""), netScheduler.usedUs(netSinkWeb));
+    out.counterUs(PSTR("net_sink_busy_seconds_total"), PSTR("sink=\"mqtt_loop\""), netScheduler.usedUs(netSinkMqttLoop));
+    out.counterUs(PSTR("net_sink_busy_seconds_total"), PSTR("sink=\"publish\""), netScheduler.usedUs(netSinkPublish));
+    out.counterUs(PSTR("net_sink_busy_seconds_total"), PSTR("sink=\"pvoutput\""), netScheduler.usedUs(netSinkPvOutput));
+    out.counterUs(PSTR("net_sink_busy_seconds_total"), PSTR("sink=\"log\""), netScheduler.usedUs(netSinkLog));
+    out.counterUs(PSTR("net_sink_busy_seconds_total"), PSTR("sink=\"bulk\""), netScheduler.usedUs(netSinkBulk));
+    out.header(PSTR("net_sink_deferred_total"), PSTR("counter"), PSTR("Loop ticks in which a sink was held back by its budget or a higher priority sink"));
+    out.counter(PSTR("net_sink_deferred_total"), PSTR("sink=\"publish\""), netScheduler.deferred(netSinkPublish));
+    out.counter(PSTR("net_sink_deferred_total"), PSTR("sink=\"pvoutput\""), netScheduler.deferred(netSinkPvOutput));
+    out.counter(PSTR("net_sink_deferred_total"), PSTR("sink=\"log\""), netScheduler.deferred(netSinkLog));
+    out.counter(PSTR("net_sink_deferred_total"), PSTR("sink=\"bulk\""), netScheduler.deferred(netSinkBulk));
+    out.header(PSTR("pvoutput_uploads_total"), PSTR("counter"), PSTR("PVOutput uploads by result"));
+    out.counter(PSTR("pvoutput_uploads_total"), PSTR("result=\"ok\""), metricsPvOutputOk);
+    out.counter(PSTR("pvoutput_uploads_total"), PSTR("result=\"failed\""), metricsPvOutputFailed);
+    out.header(PSTR("pvoutput_backlog"), PSTR("gauge"), PSTR("Readings waiting for a batch upload"));
+    out.gauge(PSTR("pvoutput_backlog"), PSTR(""), pvOutputBacklog.count());
+    out.header(PSTR("pvoutput_backlog_dropped_total"), PSTR("counter"), PSTR("Readings lost to a full backlog"));
+    out.counter(PSTR("pvoutput_backlog_dropped_total"), PSTR(""), pvOutputBacklog.dropped());
+
+    out.header(PSTR("mqtt_publish_total"), PSTR("counter"), PSTR("MQTT publishes by result"));
+    out.counter(PSTR("mqtt_publish_total"), PSTR("result=\"ok\""), metricsMqttPublishOk);
+    out.counter(PSTR("mqtt_publish_total"), PSTR("result=\"failed\""), metricsMqttPublishFailed);
+
+    out.header(PSTR("heap_free_bytes"), PSTR("gauge"), PSTR("Free heap"));
+    out.gauge(PSTR("heap_free_bytes"), PSTR(""), ESP.getFreeHeap());
+    out.header(PSTR("heap_max_free_block_bytes"), PSTR("gauge"), PSTR("Largest free heap block"));
+    out.gauge(PSTR("heap_max_free_block_bytes"), PSTR(""), ESP.getMaxFreeBlockSize());
+    out.header(PSTR("heap_fragmentation_percent"), PSTR("gauge"), PSTR("Heap fragmentation"));
+    out.gauge(PSTR("heap_fragmentation_percent"), PSTR(""), ESP.getHeapFragmentation());
+    out.header(PSTR("wifi_rssi_dbm"), PSTR("gauge"), PSTR("WiFi signal strength"));
+    out.gauge(PSTR("wifi_rssi_dbm"), PSTR(""), WiFi.RSSI());
+    out.header(PSTR("wifi_connected"), PSTR("gauge"), PSTR("WiFi up, from the connect and disconnect events"));
+    out.gauge(PSTR("wifi_connected"), PSTR(""), isWifiConnected() ? 1 : 0);
+    out.header(PSTR("wifi_outages_total"), PSTR("counter"), PSTR("WiFi disconnects after the first connection"));
+    out.counter(PSTR("wifi_outages_total"), PSTR(""), wifiOutages);
+    out.header(PSTR("wifi_outage_seconds_total"), PSTR("counter"), PSTR("Time without WiFi after the first connection, including a current outage"));
+    out.counterUs(PSTR("wifi_outage_seconds_total"), PSTR(""), (wifiOutageTotalMs + (wifiOutages > 0 && !isWifiConnected() ? millis() - wifiOutageStartMs : 0)) * 1000);
+    out.header(PSTR("wifi_outage_last_seconds"), PSTR("gauge"), PSTR("Length of the last completed WiFi outage"));
+    out.gauge(PSTR("wifi_outage_last_seconds"), PSTR(""), wifiOutageLastMs / 1e3);
+    out.header(PSTR("scheduler_task_runs_total"), PSTR("counter"), PSTR("Scheduled task runs"));
+    out.counter(PSTR("scheduler_task_runs_total"), PSTR("task=\"pvoutput\""), scheduler.runs(taskIdPvOutput));
+    out.counter(PSTR("scheduler_task_runs_total"), PSTR("task=\"stats\""), scheduler.runs(taskIdStats));
+    out.header(PSTR("scheduler_task_missed_total"), PSTR("counter"), PSTR("Scheduled task periods missed"));
+    out.counter(PSTR("scheduler_task_missed_total"), PSTR("task=\"pvoutput\""), scheduler.missed(taskIdPvOutput));
+    out.counter(PSTR("scheduler_task_missed_total"), PSTR("task=\"stats\""), scheduler.missed(taskIdStats));
+    out.header(PSTR("scheduler_stats_period_seconds"), PSTR("gauge"), PSTR("Current stats period, slower at night"));
+    out.gauge(PSTR("scheduler_stats_period_seconds"), PSTR(""), scheduler.periodMs(taskIdStats) / 1e3);
+    out.header(PSTR("solar_phase"), PSTR("gauge"), PSTR("Solar calendar: 0 night, 1 dawn, 2 day"));
+    out.gauge(PSTR("solar_phase"), PSTR(""), solarCalendar.phase(getEpochTime(), SOLAR_DAWN_LEAD, SOLAR_DUSK_MARGIN));
+    out.header(PSTR("power_save_mode"), PSTR("gauge"), PSTR("Power save: 0 off, 1 modem sleep, 2 light sleep"));
+    out.gauge(PSTR("power_save_mode"), PSTR(""), powerSave.mode());
+    out.header(PSTR("power_idle_seconds_total"), PSTR("counter"), PSTR("Time the loop spent idle, free to sleep"));
+    out.counterUs(PSTR("power_idle_seconds_total"), PSTR(""), powerSave.idleUs());
+    out.header(PSTR("power_idle_ratio"), PSTR("gauge"), PSTR("Fraction of the last minute spent idle"));
+    out.gauge(PSTR("power_idle_ratio"), PSTR(""), powerSave.idleFraction());
+    out.header(PSTR("clock_correction_seconds"), PSTR("gauge"), PSTR("Last wall clock correction from time source"));
+    out.gauge(PSTR("clock_correction_seconds"), PSTR(""), wallClock.lastCorrectionUs() / 1e6);
+    out.header(PSTR("clock_slew_pending_seconds"), PSTR("gauge"), PSTR("Correction still to be slewed"));
+    out.gauge(PSTR("clock_slew_pending_seconds"), PSTR(""), wallClock.pendingSlewUs() / 1e6);
+    out.header(PSTR("clock_steps_total"), PSTR("counter"), PSTR("Wall clock steps"));
+    out.counter(PSTR("clock_steps_total"), PSTR(""), wallClock.steps());
+    out.header(PSTR("clock_source"), PSTR("gauge"), PSTR("Wall clock source: 0 none, 1 inverter, 2 NTP"));
+    out.gauge(PSTR("clock_source"), PSTR(""), clockSource);
+    out.header(PSTR("sntp_requests_total"), PSTR("counter"), PSTR("SNTP requests sent"));
+    out.counter(PSTR("sntp_requests_total"), PSTR(""), sntpClient.requests());
+    out.header(PSTR("sntp_responses_total"), PSTR("counter"), PSTR("SNTP replies accepted"));
+    out.counter(PSTR("sntp_responses_total"), PSTR(""), sntpClient.responses());
+    out.header(PSTR("sntp_timeouts_total"), PSTR("counter"), PSTR("SNTP requests without reply"));
+    out.counter(PSTR("sntp_timeouts_total"), PSTR(""), sntpClient.timeouts());
+    out.header(PSTR("sntp_rtt_seconds"), PSTR("gauge"), PSTR("Last SNTP round trip"));
+    out.gauge(PSTR("sntp_rtt_seconds"), PSTR(""), sntpClient.rttUs() / 1e6);
+    out.header(PSTR("boot_first_sample_seconds"), PSTR("gauge"), PSTR("Time from boot to the first inverter sample"));
+    out.gauge(PSTR("boot_first_sample_seconds"), PSTR(""), bootFirstSampleMs / 1e3);
+    out.header(PSTR("loop_stalls_total"), PSTR("counter"), PSTR("Loop iterations over the stall threshold"));
+    out.counter(PSTR("loop_stalls_total"), PSTR(""), stallDetector.total());
+    out.header(PSTR("log_dropped_total"), PSTR("counter"), PSTR("Log messages dropped with the log ring full"));
+    out.counter(PSTR("log_dropped_total"), PSTR(""), logRing.dropped());
+
+    out.flush();
+    webServer.sendContent("");
+}
+
+
+// Serve recent loop stalls, most recent first
+void webHandleStalls() {
+    if (webServer.method() != HTTP_GET) {
+        webHandle404();
+        return;
+    }
+    char report[64 + STALL_HISTORY * 96];
+    size_t pos = _appendf_P(report, sizeof(report), 0,
+        PSTR("{\"threshold_ms\": %lu, \"total\": %lu, \"stalls\": ["),
+        stallDetector.thresholdMs(), (unsigned long)stallDetector.total()
+    );
+    for (uint8_t i = 0; i < stallDetector.count(); i++) {
+        if (i > 0) {
+            pos = _appendf_P(report, sizeof(report), pos, PSTR(", "));
+        }
+        pos += formatStall(stallDetector.get(i), report + pos, sizeof(report) - pos);
+    }
+    _appendf_P(report, sizeof(report), pos, PSTR("]}"));
+    webServer.send(200, "application/json", report);
 }
 
+
+// Serve events recovered from the flight recorder at boot, oldest first. Sent in chunks to keep the stack small
+void webHandleCrash() {
+    if (webServer.method() != HTTP_GET) {
+        webHandle404();
+        return;
+    }
+    char chunk[256];
+    rst_info *resetInfo = ESP.getResetInfoPtr();
+    char stageName[24];
+    strncpy_P(stageName, StallDetector::stageName(flightRecorder.dumpStage()), sizeof(stageName)-1);
+    stageName[sizeof(stageName)-1] = 0;
+    webServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    webServer.send(200, "application/json", "");
+    _appendf_P(chunk, sizeof(chunk), 0,
+        PSTR("{\"reset_reason\": %lu, \"exception\": %lu, \"epc1\": \"0x%08lx\", \"excvaddr\": \"0x%08lx\", \"recovered\": %S, \"stage\": \"%s\", \"events\": ["),
+        (unsigned long)resetInfo->reason, (unsigned long)resetInfo->exccause, (unsigned long)resetInfo->epc1, (unsigned long)resetInfo->excvaddr,
+        flightRecorder.hasDump() ? PSTR("true") : PSTR("false"), stageName
+    );
+    webServer.sendContent(chunk);
+    for (uint8_t i = 0; i < flightRecorder.dumpCount(); i++) {
+        const FlightRecorder::Event *event = flightRecorder.dumpEvent(i);
+        char typeName[12];
+        strncpy_P(typeName, FlightRecorder::typeName(event->type), sizeof(typeName)-1);
+        typeName[sizeof(typeName)-1] = 0;
+        _appendf_P(chunk, sizeof(chunk), 0, PSTR("%S{\"type\": \"%s\", \"arg\": %u, \"value\": %u}"),
+            i > 0 ? PSTR(", ") : PSTR(""), typeName, event->arg, event->value);
+        webServer.sendContent(chunk);
+    }
+    webServer.sendContent("]}");
+    webServer.sendContent("");
+}
@@ -0,0 +1,147 @@
+#include "metrics.h"
+
+
+static const uint32_t histogramBounds[HISTOGRAM_BUCKETS] PROGMEM = {
+    100, 200, 500,
+    1000, 2000, 5000,
+    10000, 20000, 50000,
+    100000, 200000, 500000,
+    1000000, 2000000, 5000000,
+    10000000, 30000000
+};
+
+
+Histogram::Histogram(): _counts{0}, _sum(0) {}
+
+void Histogram::observe(uint32_t us) {
+    uint8_t i = 0;
+    while (i < HISTOGRAM_BUCKETS && us > pgm_read_dword(&histogramBounds[i])) {
+        i++;
+    }
+    _counts[i]++;
+    _sum += us;
+}
+
+void Histogram::observeSince(unsigned long tStartUs) {
+    observe(micros() - tStartUs);
+}
+
+uint32_t Histogram::count() {
+    uint32_t total = 0;
+    for (uint8_t i = 0; i <= HISTOGRAM_BUCKETS; i++) {
+        total += _counts[i];
+    }
+    return total;
+}
+
+uint32_t Histogram::bucket(uint8_t i) {
+    return _counts[i];
+}
+
+uint64_t Histogram::sum() {
+    return _sum;
+}
+
+
+MetricsWriter::MetricsWriter(FlushFunc flush): _len(0), _flush(flush) {}
+
+void MetricsWriter::_write(const char *s) {
+    while (*s) {
+        if (_len >= sizeof(_buf) - 1) {
+            flush();
+        }
+        _buf[_len++] = *s++;
+    }
+}
+
+void MetricsWriter::_write_P(PGM_P s) {
+    char c;
+    while ((c = pgm_read_byte(s++)) != 0) {
+        if (_len >= sizeof(_buf) - 1) {
+            flush();
+        }
+        _buf[_len++] = c;
+    }
+}
+
+void MetricsWriter::_printf_P(PGM_P fmt, ...) {
+    char tmp[32];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf_P(tmp, sizeof(tmp), fmt, args);
+    va_end(args);
+    _write(tmp);
+}
+
+// Write series name and labels. With open set the label set is left open for one more label
+void MetricsWriter::_series(PGM_P name, PGM_P suffix, PGM_P labels, bool open) {
+    _write_P(name);
+    _write_P(suffix);
+    bool hasLabels = pgm_read_byte(labels) != 0;
+    if (open) {
+        _write("{");
+        _write_P(labels);
+        if (hasLabels) {
+            _write(",");
+        }
+        return;
+    }
+    if (hasLabels) {
+        _write("{");
+        _write_P(labels);
+        _write("}");
+    }
+    _write(" ");
+}
+
+void MetricsWriter::header(PGM_P name, PGM_P type, PGM_P help) {
+    _write_P(PSTR("# HELP "));
+    _write_P(name);
+    _write(" ");
+    _write_P(help);
+    _write_P(PSTR("\n# TYPE "));
+    _write_P(name);
+    _write(" ");
+    _write_P(type);
+    _write("\n");
+}
+
+void MetricsWriter::counter(PGM_P name, PGM_P labels, uint32_t val) {
+    _series(name, PSTR(""), labels, false);
+    _printf_P(PSTR("%lu\n"), (unsigned long)val);
+}
+
+void MetricsWriter::counterUs(PGM_P name, PGM_P labels, uint64_t us) {
+    _series(name, PSTR(""), labels, false);
+    _printf_P(PSTR("%.6f\n"), us / 1e6);
+}
+
+void MetricsWriter::gauge(PGM_P name, PGM_P labels, float val) {
+    _series(name, PSTR(""), labels, false);
+    _printf_P(PSTR("%g\n"), val);
+}
+
+void MetricsWriter::histogram(PGM_P name, PGM_P labels, Histogram *h) {
+    uint32_t cumulative = 0;
+    for (uint8_t i = 0; i <= HISTOGRAM_BUCKETS; i++) {
+        cumulative += h->bucket(i);
+        _series(name, PSTR("_bucket"), labels, true);
+        if (i < HISTOGRAM_BUCKETS) {
+            _printf_P(PSTR("le=\"%g\"} %lu\n"), pgm_read_dword(&histogramBounds[i]) / 1e6, (unsigned long)cumulative);
+        } else {
+            _printf_P(PSTR("le=\"+Inf\"} %lu\n"), (unsigned long)cumulative);
+        }
+    }
+    _series(name, PSTR("_sum"), labels, false);
+    _printf_P(PSTR("%.6f\n"), h->sum() / 1e6);
+    _series(name, PSTR("_count"), labels, false);
+    _printf_P(PSTR("%lu\n"), (unsigned long)cumulative);
+}
+
+void MetricsWriter::flush() {
+    if (_len > 0) {
+        _buf[_len] = 0;
+        _flush(_buf, _len);
+        _len = 0;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+// Bucket upper bounds in microseconds, 100us to 30s, plus +Inf
+#define HISTOGRAM_BUCKETS 17
+
+#ifndef METRICS_BUFFER_SIZE
+#define METRICS_BUFFER_SIZE 256
+#endif
+
+
+// Duration histogram. observe() is a few compares and increments, all formatting is done by MetricsWriter
+class Histogram {
+    private:
+        uint32_t _counts[HISTOGRAM_BUCKETS + 1];
+        uint64_t _sum;
+    public:
+        Histogram();
+        void observe(uint32_t us);
+        void observeSince(unsigned long tStartUs);
+        uint32_t count();
+        uint32_t bucket(uint8_t i);
+        uint64_t sum();
+};
+
+
+// Write Prometheus text format through a small buffer, flushed in chunks
+class MetricsWriter {
+    public:
+        typedef void (*FlushFunc)(const char *buf, size_t len);
+    private:
+        char _buf[METRICS_BUFFER_SIZE];
+        size_t _len;
+        FlushFunc _flush;
+        void _write(const char *s);
+        void _write_P(PGM_P s);
+        void _printf_P(PGM_P fmt, ...);
+        void _series(PGM_P name, PGM_P suffix, PGM_P labels, bool open);
+    public:
+        MetricsWriter(FlushFunc flush);
+        // name, help and labels are in flash. labels is "" or e.g. "command=\"dsp\""
+        void header(PGM_P name, PGM_P type, PGM_P help);
+        void counter(PGM_P name, PGM_P labels, uint32_t val);
+        // Counter of microseconds, written as seconds to full precision
+        void counterUs(PGM_P name, PGM_P labels, uint64_t us);
+        void gauge(PGM_P name, PGM_P labels, float val);
+        void histogram(PGM_P name, PGM_P labels, Histogram *h);
+        void flush();
+};
+#endif    // METRICS_H
@@ -0,0 +1,65 @@
+#include "netscheduler.h"
+
+
+NetScheduler::NetScheduler(uint32_t tickBudgetUs):
+    _count(0), _tickBudgetUs(tickBudgetUs), _tickUsedUs(0), _heldPriority(0xff) {
+}
+
+uint8_t NetScheduler::add(uint8_t priority, uint32_t budgetUs) {
+    if (_count >= NET_SCHEDULER_MAX_SINKS) {
+        return NET_NO_SINK;
+    }
+    uint8_t id = _count++;
+    _sinks[id] = {priority, false, budgetUs, (int32_t)budgetUs, 0, 0};
+    return id;
+}
+
+void NetScheduler::tick() {
+    _tickUsedUs = 0;
+    _heldPriority = 0xff;
+    for (uint8_t id = 0; id < _count; id++) {
+        Sink *sink = &_sinks[id];
+        sink->held = false;
+        sink->creditUs = min(sink->creditUs + (int32_t)sink->budgetUs, (int32_t)sink->budgetUs);
+    }
+}
+
+bool NetScheduler::allow(uint8_t id) {
+    if (id >= _count) {
+        return true;
+    }
+    Sink *sink = &_sinks[id];
+    if (sink->priority == NET_PRIORITY_CRITICAL) {
+        return true;
+    }
+    if (sink->creditUs > 0 && _tickUsedUs < _tickBudgetUs && sink->priority <= _heldPriority) {
+        return true;
+    }
+    if (!sink->held) {
+        sink->held = true;
+        sink->deferred++;
+    }
+    _heldPriority = min(_heldPriority, sink->priority);
+    return false;
+}
+
+void NetScheduler::spendSince(uint8_t id, unsigned long tStartUs) {
+    if (id >= _count) {
+        return;
+    }
+    Sink *sink = &_sinks[id];
+    uint32_t us = micros() - tStartUs;
+    _tickUsedUs += us;
+    sink->usedUs += us;
+    // Debt is capped so a single very long operation does not silence the sink for minutes
+    int64_t floorUs = -(int64_t)sink->budgetUs * NET_SCHEDULER_DEBT_TICKS;
+    sink->creditUs = (int32_t)max((int64_t)sink->creditUs - us, floorUs);
+}
+
+uint64_t NetScheduler::usedUs(uint8_t id) {
+    return _sinks[id].usedUs;
+}
+
+uint32_t NetScheduler::deferred(uint8_t id) {
+    return _sinks[id].deferred;
+}
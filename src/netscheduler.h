@@ -0,0 +1,54 @@
+#ifndef NETSCHEDULER_H
+#define NETSCHEDULER_H
+
+#include <Arduino.h>
+
+#ifndef NET_SCHEDULER_MAX_SINKS
+#define NET_SCHEDULER_MAX_SINKS 8
+#endif
+
+#ifndef NET_SCHEDULER_DEBT_TICKS
+#define NET_SCHEDULER_DEBT_TICKS 100 // Longest wait, in ticks of budget, after one operation overran its budget
+#endif
+
+#define NET_NO_SINK 0xff
+#define NET_PRIORITY_CRITICAL 0 // Always runs, e.g. the web server and MQTT keepalive
+
+
+// Time budgets for the network sinks sharing loop(). Each sink earns its budget every tick, banking at most one
+// tick's worth, and pays for the time its work took. An operation that overran, e.g. a blocking upload, leaves a
+// debt that holds the sink back until later ticks have paid it off, which bounds its share of loop time.
+// Critical sinks always run. Others run only while they are in credit, the tick's total budget is not spent and no
+// higher priority sink has been held back in the same tick. Producers ask allow() before starting work and keep
+// it queued, or hand it to a lower priority path, when refused.
+class NetScheduler {
+    private:
+        struct Sink {
+            uint8_t priority;
+            bool held;
+            uint32_t budgetUs;
+            int32_t creditUs;
+            uint64_t usedUs;
+            uint32_t deferred;
+        };
+        Sink _sinks[NET_SCHEDULER_MAX_SINKS];
+        uint8_t _count;
+        uint32_t _tickBudgetUs;
+        uint32_t _tickUsedUs;
+        uint8_t _heldPriority;
+    public:
+        NetScheduler(uint32_t tickBudgetUs);
+        // Register a sink, returns its id or NET_NO_SINK. Lower priority numbers go first
+        uint8_t add(uint8_t priority, uint32_t budgetUs);
+        // Start of a loop tick: pay each sink its budget
+        void tick();
+        // May the sink start an operation now. A refusal holds back lower priority sinks for the rest of the tick
+        bool allow(uint8_t id);
+        // Charge the sink for an operation started at tStartUs
+        void spendSince(uint8_t id, unsigned long tStartUs);
+        // Total time spent by the sink
+        uint64_t usedUs(uint8_t id);
+        // Ticks in which the sink was refused
+        uint32_t deferred(uint8_t id);
+};
+#endif    // NETSCHEDULER_H
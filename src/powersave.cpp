@@ -0,0 +1,51 @@
+#include "powersave.h"
+
+
+PowerSave::PowerSave(uint8_t mode, uint8_t listenInterval, uint32_t maxIdleMs):
+    _mode(mode), _listenInterval(listenInterval), _maxIdleMs(maxIdleMs), _idleUs(0), _windowStartUs(0),
+    _windowIdleUs(0), _idleFraction(0) {
+}
+
+void PowerSave::begin() {
+    switch (_mode) {
+        case POWER_SAVE_LIGHT:
+            WiFi.setSleepMode(WIFI_LIGHT_SLEEP, _listenInterval);
+            break;
+        case POWER_SAVE_MODEM:
+            WiFi.setSleepMode(WIFI_MODEM_SLEEP, _listenInterval);
+            break;
+        default:
+            WiFi.setSleepMode(WIFI_NONE_SLEEP);
+            break;
+    }
+    _windowStartUs = micros64();
+}
+
+void PowerSave::idle(uint32_t ms) {
+    uint64_t now = micros64();
+    if (now - _windowStartUs >= POWER_SAVE_WINDOW_MS * 1000ULL) {
+        _idleFraction = (float)(_idleUs - _windowIdleUs) / (now - _windowStartUs);
+        _windowStartUs = now;
+        _windowIdleUs = _idleUs;
+    }
+    ms = min(ms, _maxIdleMs);
+    if (_mode == POWER_SAVE_OFF || ms == 0) {
+        yield();
+        return;
+    }
+    // The SDK sleeps inside delay() once nothing else is pending
+    delay(ms);
+    _idleUs += micros64() - now;
+}
+
+uint8_t PowerSave::mode() {
+    return _mode;
+}
+
+uint64_t PowerSave::idleUs() {
+    return _idleUs;
+}
+
+float PowerSave::idleFraction() {
+    return _idleFraction;
+}
@@ -0,0 +1,40 @@
+#ifndef POWERSAVE_H
+#define POWERSAVE_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#ifndef POWER_SAVE_WINDOW_MS
+#define POWER_SAVE_WINDOW_MS 60000 // Window for the idle fraction
+#endif
+
+#define POWER_SAVE_OFF   0 // Radio always on, loop never idles
+#define POWER_SAVE_MODEM 1 // Radio off between DTIM beacons, CPU idles in delay()
+#define POWER_SAVE_LIGHT 2 // Radio and CPU clock off between DTIM beacons while idle
+
+
+// Idles the loop until the next piece of work, so the SDK can put the modem, or modem and CPU, to sleep.
+// Sleep is automatic: the radio still wakes for every listenInterval-th DTIM beacon, so MQTT and the web server
+// keep working with up to listenInterval beacon intervals of extra latency.
+class PowerSave {
+    private:
+        uint8_t _mode;
+        uint8_t _listenInterval;
+        uint32_t _maxIdleMs;
+        uint64_t _idleUs;
+        uint64_t _windowStartUs;
+        uint64_t _windowIdleUs;
+        float _idleFraction;
+    public:
+        PowerSave(uint8_t mode, uint8_t listenInterval, uint32_t maxIdleMs);
+        // Call before WiFi.begin()
+        void begin();
+        // Idle for ms, capped at maxIdleMs, or just yield if ms is 0. Call at the end of loop()
+        void idle(uint32_t ms);
+        uint8_t mode();
+        // Total time spent idle
+        uint64_t idleUs();
+        // Fraction of the last POWER_SAVE_WINDOW_MS spent idle
+        float idleFraction();
+};
+#endif    // POWERSAVE_H
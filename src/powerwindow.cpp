@@ -0,0 +1,56 @@
+#include "powerwindow.h"
+
+
+PowerWindow::PowerWindow():
+    _lastMs(0), _spanMs(0), _last(NAN), _hasLast(false), _integral(0), _minimum(NAN), _maximum(NAN), _count(0) {
+}
+
+void PowerWindow::add(uint32_t ms, float power) {
+    if (isnan(power)) {
+        return;
+    }
+    uint32_t dt = ms - _lastMs;
+    if (_hasLast && dt <= POWER_WINDOW_MAX_GAP_MS) {
+        // Trapezoid from the previous sample, which may belong to the previous window
+        _integral += (double)(_last + power) / 2 * dt;
+        _spanMs += dt;
+    }
+    _hasLast = true;
+    if (_count == 0 || power < _minimum) {
+        _minimum = power;
+    }
+    if (_count == 0 || power > _maximum) {
+        _maximum = power;
+    }
+    _last = power;
+    _lastMs = ms;
+    _count++;
+}
+
+uint16_t PowerWindow::count() {
+    return _count;
+}
+
+float PowerWindow::mean() {
+    if (_count == 0) {
+        return NAN;
+    }
+    if (_spanMs == 0) {
+        return _last;
+    }
+    return _integral / _spanMs;
+}
+
+float PowerWindow::minimum() {
+    return _count > 0 ? _minimum : NAN;
+}
+
+float PowerWindow::maximum() {
+    return _count > 0 ? _maximum : NAN;
+}
+
+void PowerWindow::reset() {
+    _spanMs = 0;
+    _integral = 0;
+    _count = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef POWERWINDOW_H
+#define POWERWINDOW_H
+
+#include <Arduino.h>
+
+#ifndef POWER_WINDOW_MAX_GAP_MS
+#define POWER_WINDOW_MAX_GAP_MS 600000 // Longer gaps between samples, e.g. overnight, are left out of the mean
+#endif
+
+
+// Time weighted mean, minimum and maximum of a power reading over a window, e.g. one PVOutput interval.
+// Consecutive samples are joined by straight lines, so uneven spacing from missed sweeps or extra reads does not
+// bias the mean. reset() starts the next window at the last sample, no time is lost between windows.
+class PowerWindow {
+    private:
+        uint32_t _lastMs;
+        uint32_t _spanMs;
+        float _last;
+        bool _hasLast;
+        double _integral;
+        float _minimum;
+        float _maximum;
+        uint16_t _count;
+    public:
+        PowerWindow();
+        // NaN samples are ignored
+        void add(uint32_t ms, float power);
+        // Samples added since the last reset
+        uint16_t count();
+        // Time weighted mean, the sample itself if there is just one, NaN if there are none
+        float mean();
+        float minimum();
+        float maximum();
+        void reset();
+};
+#endif    // POWERWINDOW_H
@@ -0,0 +1,52 @@
+#include "pvbacklog.h"
+
+
+PvOutputBacklog::PvOutputBacklog():
+    _first(0), _count(0), _dropped(0) {
+}
+
+void PvOutputBacklog::push(uint8_t address, unsigned long time, unsigned long energy, float power) {
+    if (_count == PVOUTPUT_BACKLOG_SIZE) {
+        _first = (_first + 1) % PVOUTPUT_BACKLOG_SIZE;
+        _count--;
+        _dropped++;
+    }
+    Reading *r = &_readings[(_first + _count) % PVOUTPUT_BACKLOG_SIZE];
+    r->address = address;
+    r->time = time;
+    r->energy = energy;
+    r->power = power;
+    _count++;
+}
+
+uint8_t PvOutputBacklog::count() {
+    return _count;
+}
+
+const PvOutputBacklog::Reading *PvOutputBacklog::reading(uint8_t i) {
+    return &_readings[(_first + i) % PVOUTPUT_BACKLOG_SIZE];
+}
+
+void PvOutputBacklog::remove(uint8_t address, uint8_t n) {
+    // Compact in place, keeping everything except the first n readings of address
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < _count; i++) {
+        Reading *r = &_readings[(_first + i) % PVOUTPUT_BACKLOG_SIZE];
+        if (r->address == address && n > 0) {
+            n--;
+            continue;
+        }
+        if (kept != i) {
+            _readings[(_first + kept) % PVOUTPUT_BACKLOG_SIZE] = *r;
+        }
+        kept++;
+    }
+    _count = kept;
+    if (_count == 0) {
+        _first = 0;
+    }
+}
+
+uint32_t PvOutputBacklog::dropped() {
+    return _dropped;
+}
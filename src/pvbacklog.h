@@ -0,0 +1,37 @@
+#ifndef PVBACKLOG_H
+#define PVBACKLOG_H
+
+#include <Arduino.h>
+
+#ifndef PVOUTPUT_BACKLOG_SIZE
+#define PVOUTPUT_BACKLOG_SIZE 48 // Readings held over a WiFi or PVOutput outage, 4 hours at one inverter and 5 minutes
+#endif
+
+
+// PVOutput readings that could not be sent, oldest first, for a batch upload once the network is back.
+// When full the oldest reading is dropped, the newest ones matter most for the live view
+class PvOutputBacklog {
+    public:
+        struct Reading {
+            uint8_t address;
+            unsigned long time;
+            unsigned long energy;
+            float power;
+        };
+    private:
+        Reading _readings[PVOUTPUT_BACKLOG_SIZE];
+        uint8_t _first;
+        uint8_t _count;
+        uint32_t _dropped;
+    public:
+        PvOutputBacklog();
+        void push(uint8_t address, unsigned long time, unsigned long energy, float power);
+        uint8_t count();
+        // i-th oldest reading, 0 <= i < count()
+        const Reading *reading(uint8_t i);
+        // Remove the n oldest readings of one inverter, readings of other inverters keep their order
+        void remove(uint8_t address, uint8_t n);
+        // Readings lost to a full backlog
+        uint32_t dropped();
+};
+#endif    // PVBACKLOG_H
@@ -0,0 +1,105 @@
+#include "recorder.h"
+
+
+#define FLIGHT_RECORDER_MAGIC 0x46524543 // "FREC"
+#define FLIGHT_RECORDER_MAGIC_BLOCK  RTC_BLOCK_FLIGHT_RECORDER
+#define FLIGHT_RECORDER_HEADER_BLOCK (RTC_BLOCK_FLIGHT_RECORDER + 1)
+#define FLIGHT_RECORDER_EVENT_BLOCK  (RTC_BLOCK_FLIGHT_RECORDER + 2)
+
+static_assert(sizeof(FlightRecorder::Event) == 4, "FlightRecorder::Event must fit one RTC block");
+
+
+static const char eventNone[] PROGMEM = "none";
+static const char eventBoot[] PROGMEM = "boot";
+static const char eventUptime[] PROGMEM = "uptime";
+static const char eventAurora[] PROGMEM = "aurora";
+static const char eventHttp[] PROGMEM = "http";
+static const char eventMqtt[] PROGMEM = "mqtt";
+static const char eventWifi[] PROGMEM = "wifi";
+static const char eventHeap[] PROGMEM = "heap";
+static const char eventStall[] PROGMEM = "stall";
+
+static PGM_P const eventNames[FR_EVENT_COUNT] PROGMEM = {
+    eventNone,
+    eventBoot,
+    eventUptime,
+    eventAurora,
+    eventHttp,
+    eventMqtt,
+    eventWifi,
+    eventHeap,
+    eventStall,
+};
+
+
+FlightRecorder::FlightRecorder(): _header{0, 0, 0, 0}, _dumpCount(0), _dumpStage(0), _dumpValid(false) {}
+
+void FlightRecorder::_writeHeader() {
+    ESP.rtcUserMemoryWrite(FLIGHT_RECORDER_HEADER_BLOCK, (uint32_t *)&_header, sizeof(_header));
+}
+
+void FlightRecorder::begin() {
+    uint32_t magic = 0;
+    Header header;
+    ESP.rtcUserMemoryRead(FLIGHT_RECORDER_MAGIC_BLOCK, &magic, sizeof(magic));
+    ESP.rtcUserMemoryRead(FLIGHT_RECORDER_HEADER_BLOCK, (uint32_t *)&header, sizeof(header));
+    if (magic == FLIGHT_RECORDER_MAGIC && header.count <= FLIGHT_RECORDER_EVENTS && header.next < FLIGHT_RECORDER_EVENTS) {
+        Event events[FLIGHT_RECORDER_EVENTS];
+        ESP.rtcUserMemoryRead(FLIGHT_RECORDER_EVENT_BLOCK, (uint32_t *)events, sizeof(events));
+        // Unroll the ring, oldest first
+        uint8_t first = (header.next + FLIGHT_RECORDER_EVENTS - header.count) % FLIGHT_RECORDER_EVENTS;
+        for (uint8_t i = 0; i < header.count; i++) {
+            _dump[i] = events[(first + i) % FLIGHT_RECORDER_EVENTS];
+        }
+        _dumpCount = header.count;
+        _dumpStage = header.stage;
+        _dumpValid = true;
+    }
+    _header = {0, 0, 0, 0};
+    magic = FLIGHT_RECORDER_MAGIC;
+    ESP.rtcUserMemoryWrite(FLIGHT_RECORDER_MAGIC_BLOCK, &magic, sizeof(magic));
+    _writeHeader();
+}
+
+void FlightRecorder::record(uint8_t type, uint8_t arg, uint16_t value) {
+    Event event = {type, arg, value};
+    ESP.rtcUserMemoryWrite(FLIGHT_RECORDER_EVENT_BLOCK + _header.next, (uint32_t *)&event, sizeof(event));
+    _header.next = (_header.next + 1) % FLIGHT_RECORDER_EVENTS;
+    if (_header.count < FLIGHT_RECORDER_EVENTS) {
+        _header.count++;
+    }
+    _writeHeader();
+}
+
+void FlightRecorder::stage(uint8_t stage) {
+    if (stage != _header.stage) {
+        _header.stage = stage;
+        _writeHeader();
+    }
+}
+
+bool FlightRecorder::hasDump() {
+    return _dumpValid;
+}
+
+uint8_t FlightRecorder::dumpCount() {
+    return _dumpCount;
+}
+
+const FlightRecorder::Event *FlightRecorder::dumpEvent(uint8_t i) {
+    if (i >= _dumpCount) {
+        return NULL;
+    }
+    return &_dump[i];
+}
+
+uint8_t FlightRecorder::dumpStage() {
+    return _dumpStage;
+}
+
+PGM_P FlightRecorder::typeName(uint8_t type) {
+    if (type >= FR_EVENT_COUNT) {
+        return PSTR("unknown");
+    }
+    return (PGM_P)pgm_read_ptr(&eventNames[type]);
+}
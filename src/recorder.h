@@ -0,0 +1,57 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <Arduino.h>
+#include "rtcmem.h"
+
+// Two header blocks, the rest hold one event each
+#define FLIGHT_RECORDER_EVENTS (RTC_BLOCKS_FLIGHT_RECORDER - 2)
+
+#define FR_EVENT_NONE   0
+#define FR_EVENT_BOOT   1 // arg: reset reason, value: exception cause
+#define FR_EVENT_UPTIME 2 // value: uptime minutes
+#define FR_EVENT_AURORA 3 // Failed requests only, arg: command | result << 4, value: latency ms
+#define FR_EVENT_HTTP   4 // value: HTTP code, negative for client errors
+#define FR_EVENT_MQTT   5 // arg: 1 connected, 0 disconnected, value: client state
+#define FR_EVENT_WIFI   6 // arg: 1 connected, 0 disconnected, value: disconnect reason
+#define FR_EVENT_HEAP   7 // value: free heap low-water mark
+#define FR_EVENT_STALL  8 // arg: stage, value: duration ms
+#define FR_EVENT_COUNT  9
+
+
+// Circular event log in RTC user memory, recovered after a watchdog or exception reset.
+// Each event is one 4 byte block so recording is a single RTC write plus the header.
+class FlightRecorder {
+    public:
+        struct Event {
+            uint8_t type;
+            uint8_t arg;
+            uint16_t value;
+        };
+    private:
+        struct Header {
+            uint8_t next;
+            uint8_t count;
+            uint8_t stage;
+            uint8_t reserved;
+        };
+        Header _header;
+        Event _dump[FLIGHT_RECORDER_EVENTS];
+        uint8_t _dumpCount;
+        uint8_t _dumpStage;
+        bool _dumpValid;
+        void _writeHeader();
+    public:
+        FlightRecorder();
+        // Recover events of the previous run, then start recording afresh
+        void begin();
+        void record(uint8_t type, uint8_t arg, uint16_t value);
+        void stage(uint8_t stage);
+        // Events recovered at boot, oldest first
+        bool hasDump();
+        uint8_t dumpCount();
+        const Event *dumpEvent(uint8_t i);
+        uint8_t dumpStage();
+        static PGM_P typeName(uint8_t type);
+};
+#endif    // RECORDER_H
@@ -0,0 +1,28 @@
+#include "rtcmem.h"
+
+
+uint32_t crc32(const void *data, size_t len, uint32_t crc) {
+    const uint8_t *p = (const uint8_t *)data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (uint8_t i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+bool rtcLoad(uint32_t block, void *data, size_t size) {
+    if (!ESP.rtcUserMemoryRead(block, (uint32_t *)data, size)) {
+        return false;
+    }
+    uint32_t *crc = (uint32_t *)data;
+    return *crc == crc32(crc + 1, size - sizeof(uint32_t));
+}
+
+void rtcStore(uint32_t block, void *data, size_t size) {
+    uint32_t *crc = (uint32_t *)data;
+    *crc = crc32(crc + 1, size - sizeof(uint32_t));
+    ESP.rtcUserMemoryWrite(block, (uint32_t *)data, size);
+}
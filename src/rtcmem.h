@@ -0,0 +1,22 @@
+#ifndef RTCMEM_H
+#define RTCMEM_H
+
+#include <Arduino.h>
+
+// RTC user memory layout, in 4 byte blocks of the 128 available. Contents survive everything except power loss.
+// Blocks 0-31 are reserved, eboot uses them for OTA commands.
+#define RTC_BLOCK_WIFI            32
+#define RTC_BLOCKS_WIFI           8
+#define RTC_BLOCK_STATE           40
+#define RTC_BLOCKS_STATE          32
+#define RTC_BLOCK_FLIGHT_RECORDER 72
+#define RTC_BLOCKS_FLIGHT_RECORDER 56
+
+
+uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+
+// Load and store a struct with a leading CRC word, size a multiple of 4. rtcLoad returns false if the CRC does not match
+bool rtcLoad(uint32_t block, void *data, size_t size);
+void rtcStore(uint32_t block, void *data, size_t size);
+
+#endif    // RTCMEM_H
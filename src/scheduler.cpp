@@ -0,0 +1,168 @@
+#include "scheduler.h"
+
+
+#define SCHEDULER_SLOT_MASK (SCHEDULER_SLOTS - 1)
+
+static_assert((SCHEDULER_SLOTS & SCHEDULER_SLOT_MASK) == 0, "SCHEDULER_SLOTS must be a power of 2");
+
+
+// Tick comparisons by signed difference, so they hold across counter wraparound
+static inline int32_t tickDiff(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b);
+}
+
+
+Scheduler::Scheduler(EpochFunc epoch): _count(0), _tick(0), _lastMs(0), _epoch(epoch) {
+    memset(_slots, SCHEDULER_NO_TASK, sizeof(_slots));
+}
+
+void Scheduler::_insert(uint8_t id) {
+    uint8_t slot = _tasks[id].dueTick & SCHEDULER_SLOT_MASK;
+    _tasks[id].next = _slots[slot];
+    _slots[slot] = id;
+}
+
+void Scheduler::_unlink(uint8_t id) {
+    uint8_t *link = &_slots[_tasks[id].dueTick & SCHEDULER_SLOT_MASK];
+    while (*link != SCHEDULER_NO_TASK) {
+        if (*link == id) {
+            *link = _tasks[id].next;
+            return;
+        }
+        link = &_tasks[*link].next;
+    }
+}
+
+// Set the next due tick of a task from the current tick. After a run, a boundary within SCHEDULER_ALIGN_SLACK_MS,
+// or half a period if shorter, is the one just served: the epoch is whole seconds and a clock slewing back can run
+// the task just before its boundary
+void Scheduler::_reschedule(uint8_t id, bool ran) {
+    Task *task = &_tasks[id];
+    uint32_t delayMs = task->periodMs;
+    unsigned long epoch = _epoch ? _epoch() : 0;
+    if (task->align && epoch != 0) {
+        uint32_t periodS = task->periodMs / 1000;
+        uint32_t offsetS = task->offsetMs / 1000;
+        delayMs = (periodS - ((epoch + periodS - (offsetS % periodS)) % periodS)) * 1000;
+        if (ran && delayMs <= min((uint32_t)SCHEDULER_ALIGN_SLACK_MS, task->periodMs / 2)) {
+            delayMs += task->periodMs;
+        }
+    }
+    task->dueTick = _tick + max(delayMs / SCHEDULER_TICK_MS, (uint32_t)1);
+    _insert(id);
+}
+
+uint8_t Scheduler::add(PGM_P name, TaskFunc func, uint32_t periodMs, bool align, uint32_t offsetMs, uint8_t policy) {
+    if (_count >= SCHEDULER_MAX_TASKS || periodMs < SCHEDULER_TICK_MS) {
+        return SCHEDULER_NO_TASK;
+    }
+    if (_count == 0) {
+        _lastMs = millis();
+    }
+    uint8_t id = _count++;
+    _tasks[id] = {func, name, periodMs, offsetMs, 0, 0, 0, 0, policy, align, SCHEDULER_NO_TASK};
+    _reschedule(id);
+    return id;
+}
+
+void Scheduler::realign() {
+    for (uint8_t id = 0; id < _count; id++) {
+        if (_tasks[id].align) {
+            _unlink(id);
+            _reschedule(id, _tasks[id].runs + _tasks[id].missed > 0 && _tasks[id].ranTick == _tick);
+        }
+    }
+}
+
+void Scheduler::runSoon(uint8_t id) {
+    if (id >= _count) {
+        return;
+    }
+    _unlink(id);
+    _tasks[id].dueTick = _tick + 1;
+    _insert(id);
+}
+
+void Scheduler::setPeriod(uint8_t id, uint32_t periodMs) {
+    if (id >= _count || periodMs < SCHEDULER_TICK_MS || _tasks[id].periodMs == periodMs) {
+        return;
+    }
+    _tasks[id].periodMs = periodMs;
+    _unlink(id);
+    _reschedule(id);
+}
+
+uint32_t Scheduler::periodMs(uint8_t id) {
+    return _tasks[id].periodMs;
+}
+
+void Scheduler::run() {
+    uint32_t ticks = (millis() - _lastMs) / SCHEDULER_TICK_MS;
+    if (ticks == 0) {
+        return;
+    }
+    _lastMs += ticks * SCHEDULER_TICK_MS;
+    _tick += ticks;
+    // After a long stall every slot is visited once, rather than once per elapsed tick
+    uint32_t visits = min(ticks, (uint32_t)SCHEDULER_SLOTS);
+    for (uint32_t t = _tick - visits + 1; tickDiff(t, _tick) <= 0; t++) {
+        // Collect due tasks first, running them relinks the slot lists
+        uint8_t due[SCHEDULER_MAX_TASKS];
+        uint8_t dueCount = 0;
+        for (uint8_t id = _slots[t & SCHEDULER_SLOT_MASK]; id != SCHEDULER_NO_TASK; id = _tasks[id].next) {
+            if (tickDiff(_tasks[id].dueTick, _tick) <= 0) {
+                due[dueCount++] = id;
+            }
+        }
+        for (uint8_t i = 0; i < dueCount; i++) {
+            Task *task = &_tasks[due[i]];
+            int32_t lateTicks = tickDiff(_tick, task->dueTick);
+            if (lateTicks < 0) {
+                // Rescheduled by a task that ran before it, e.g. realign() after a clock step
+                continue;
+            }
+            uint32_t missed = (uint32_t)lateTicks * SCHEDULER_TICK_MS / task->periodMs;
+            task->missed += missed;
+            task->ranTick = _tick;
+            _unlink(due[i]);
+            _reschedule(due[i], true);
+            if (missed == 0 || task->policy == SCHEDULE_COALESCE) {
+                task->runs++;
+                task->func();
+            }
+        }
+    }
+}
+
+uint32_t Scheduler::nextDueMs() {
+    uint32_t next = 0xffffffff;
+    for (uint8_t id = 0; id < _count; id++) {
+        next = min(next, dueMs(id));
+    }
+    return next;
+}
+
+uint32_t Scheduler::dueMs(uint8_t id) {
+    int32_t ticks = tickDiff(_tasks[id].dueTick, _tick);
+    if (ticks <= 0) {
+        return 0;
+    }
+    int32_t ms = ticks * SCHEDULER_TICK_MS - (millis() - _lastMs);
+    return ms > 0 ? ms : 0;
+}
+
+uint8_t Scheduler::count() {
+    return _count;
+}
+
+PGM_P Scheduler::name(uint8_t id) {
+    return _tasks[id].name;
+}
+
+uint32_t Scheduler::runs(uint8_t id) {
+    return _tasks[id].runs;
+}
+
+uint32_t Scheduler::missed(uint8_t id) {
+    return _tasks[id].missed;
+}
@@ -0,0 +1,81 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+#ifndef SCHEDULER_TICK_MS
+#define SCHEDULER_TICK_MS 100
+#endif
+
+#ifndef SCHEDULER_SLOTS
+#define SCHEDULER_SLOTS 32 // Must be a power of 2
+#endif
+
+#ifndef SCHEDULER_MAX_TASKS
+#define SCHEDULER_MAX_TASKS 8
+#endif
+
+#ifndef SCHEDULER_ALIGN_SLACK_MS
+#define SCHEDULER_ALIGN_SLACK_MS 2000 // An aligned boundary this close after a run was served by it, covers CLOCK_STEP_US slews
+#endif
+
+#define SCHEDULER_NO_TASK 0xff
+
+// Missed deadline policy, applied when a task runs a whole period or more late
+#define SCHEDULE_SKIP     0 // Drop the late run, wait for the next period boundary
+#define SCHEDULE_COALESCE 1 // Run once for all missed periods, then wait for the next period boundary
+
+
+// Cooperative scheduler on a hashed timer wheel, driven by millis() and safe across its 49 day rollover.
+// Tasks run from run() in loop context. Aligned tasks run on wall clock multiples of their period, re-aligned
+// after every run so wall clock steps never cause a burst of catch-up runs.
+class Scheduler {
+    public:
+        typedef void (*TaskFunc)(void);
+        // Wall clock in epoch seconds, 0 if not yet known
+        typedef unsigned long (*EpochFunc)(void);
+    private:
+        struct Task {
+            TaskFunc func;
+            PGM_P name;
+            uint32_t periodMs;
+            uint32_t offsetMs;
+            uint32_t dueTick;
+            uint32_t ranTick;
+            uint32_t runs;
+            uint32_t missed;
+            uint8_t policy;
+            bool align;
+            uint8_t next;
+        };
+        Task _tasks[SCHEDULER_MAX_TASKS];
+        uint8_t _slots[SCHEDULER_SLOTS];
+        uint8_t _count;
+        uint32_t _tick;
+        unsigned long _lastMs;
+        EpochFunc _epoch;
+        void _insert(uint8_t id);
+        void _unlink(uint8_t id);
+        void _reschedule(uint8_t id, bool ran = false);
+    public:
+        Scheduler(EpochFunc epoch);
+        // Register a task, returns its id or SCHEDULER_NO_TASK. Aligned tasks need a period of whole seconds
+        uint8_t add(PGM_P name, TaskFunc func, uint32_t periodMs, bool align, uint32_t offsetMs, uint8_t policy);
+        // Re-align all tasks, e.g. after the wall clock is first set. Safe from a task: tasks that already ran this
+        // tick keep their next boundary, those still waiting to run this tick move to their new boundary
+        void realign();
+        // Run a task on the next tick, then continue on its normal period
+        void runSoon(uint8_t id);
+        // Change the period of a task. The next run moves to one new period from now, or the next aligned boundary
+        void setPeriod(uint8_t id, uint32_t periodMs);
+        uint32_t periodMs(uint8_t id);
+        void run();
+        // Milliseconds until the next task is due
+        uint32_t nextDueMs();
+        uint32_t dueMs(uint8_t id);
+        uint8_t count();
+        PGM_P name(uint8_t id);
+        uint32_t runs(uint8_t id);
+        uint32_t missed(uint8_t id);
+};
+#endif    // SCHEDULER_H
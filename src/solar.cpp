@@ -0,0 +1,71 @@
+#include "solar.h"
+#include <limits.h>
+
+
+#define SOLAR_J2000_NOON 946728000 // 2000-01-01 12:00 UTC in epoch seconds
+#define SOLAR_DAY_S      86400
+
+#define SOLAR_POLAR_NONE  0
+#define SOLAR_POLAR_DAY   1
+#define SOLAR_POLAR_NIGHT 2
+
+
+SolarCalendar::SolarCalendar(float latitude, float longitude):
+    _latitude(latitude), _longitude(longitude), _day(LONG_MIN), _sunrise(0), _sunset(0), _polar(SOLAR_POLAR_NONE) {
+}
+
+bool SolarCalendar::enabled() {
+    return !isnan(_latitude) && !isnan(_longitude);
+}
+
+// Sunrise equation for the solar noon of a day counted from J2000. Double precision, float would lose minutes
+void SolarCalendar::_compute(long day) {
+    double meanNoon = day - _longitude / 360.0;
+    double m = fmod(357.5291 + 0.98560028 * meanNoon, 360.0) * DEG_TO_RAD;
+    double center = 1.9148 * sin(m) + 0.0200 * sin(2 * m) + 0.0003 * sin(3 * m);
+    double lambda = fmod(m * RAD_TO_DEG + center + 180.0 + 102.9372, 360.0) * DEG_TO_RAD;
+    double transit = meanNoon + 0.0053 * sin(m) - 0.0069 * sin(2 * lambda);
+    double sinDecl = sin(lambda) * sin(23.4397 * DEG_TO_RAD);
+    double cosDecl = cos(asin(sinDecl));
+    double lat = _latitude * DEG_TO_RAD;
+    double cosHour = (sin(-0.833 * DEG_TO_RAD) - sin(lat) * sinDecl) / (cos(lat) * cosDecl);
+    _day = day;
+    if (cosHour > 1) {
+        _polar = SOLAR_POLAR_NIGHT;
+        return;
+    }
+    if (cosHour < -1) {
+        _polar = SOLAR_POLAR_DAY;
+        return;
+    }
+    _polar = SOLAR_POLAR_NONE;
+    double halfDay = acos(cosHour) * RAD_TO_DEG / 360.0;
+    _sunrise = SOLAR_J2000_NOON + (long)((transit - halfDay) * SOLAR_DAY_S);
+    _sunset = SOLAR_J2000_NOON + (long)((transit + halfDay) * SOLAR_DAY_S);
+}
+
+bool SolarCalendar::sunTimes(unsigned long epoch, unsigned long *sunrise, unsigned long *sunset) {
+    // Day of the solar noon nearest to epoch
+    long day = lround(((double)epoch - SOLAR_J2000_NOON) / SOLAR_DAY_S + _longitude / 360.0);
+    if (day != _day) {
+        _compute(day);
+    }
+    *sunrise = _sunrise;
+    *sunset = _sunset;
+    return _polar == SOLAR_POLAR_NONE;
+}
+
+uint8_t SolarCalendar::phase(unsigned long epoch, unsigned long dawnLead, unsigned long duskMargin) {
+    if (!enabled() || epoch == 0) {
+        return SOLAR_DAY;
+    }
+    unsigned long sunrise;
+    unsigned long sunset;
+    if (!sunTimes(epoch, &sunrise, &sunset)) {
+        return _polar == SOLAR_POLAR_DAY ? SOLAR_DAY : SOLAR_NIGHT;
+    }
+    if (epoch + dawnLead < sunrise || epoch > sunset + duskMargin) {
+        return SOLAR_NIGHT;
+    }
+    return epoch < sunrise ? SOLAR_DAWN : SOLAR_DAY;
+}
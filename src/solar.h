@@ -0,0 +1,33 @@
+#ifndef SOLAR_H
+#define SOLAR_H
+
+#include <Arduino.h>
+
+#define SOLAR_NIGHT 0
+#define SOLAR_DAWN  1
+#define SOLAR_DAY   2
+
+
+// Sunrise and sunset from latitude and longitude, with the sunrise equation (NOAA simplified, refraction and solar
+// disc included). Good to a minute or two away from the polar circles, plenty for deciding when to poll.
+// Results are cached per solar day.
+class SolarCalendar {
+    private:
+        float _latitude;
+        float _longitude;
+        long _day;
+        unsigned long _sunrise;
+        unsigned long _sunset;
+        uint8_t _polar;
+        void _compute(long day);
+    public:
+        // Degrees, north and east positive. NaN disables the calendar
+        SolarCalendar(float latitude, float longitude);
+        bool enabled();
+        // Sunrise and sunset in epoch seconds around the solar noon nearest to epoch. False during polar day or night
+        bool sunTimes(unsigned long epoch, unsigned long *sunrise, unsigned long *sunset);
+        // SOLAR_DAWN from dawnLead seconds before sunrise, SOLAR_DAY from sunrise until duskMargin seconds after
+        // sunset, SOLAR_NIGHT otherwise. SOLAR_DAY when disabled or epoch is 0 (clock not set)
+        uint8_t phase(unsigned long epoch, unsigned long dawnLead, unsigned long duskMargin);
+};
+#endif    // SOLAR_H
@@ -0,0 +1,116 @@
+#include "stall.h"
+
+
+static const char stageLoop[] PROGMEM = "loop";
+static const char stageLog[] PROGMEM = "log";
+static const char stageMqttLoop[] PROGMEM = "mqtt_loop";
+static const char stageNtp[] PROGMEM = "ntp";
+static const char stageWeb[] PROGMEM = "web";
+static const char stageLed[] PROGMEM = "led";
+static const char stageDelay[] PROGMEM = "delay";
+static const char stageWifi[] PROGMEM = "wifi";
+static const char stageMqttConnect[] PROGMEM = "mqtt_connect";
+static const char stageMqttPublish[] PROGMEM = "mqtt_publish";
+static const char stageInverter[] PROGMEM = "inverter";
+static const char stagePvOutputConnect[] PROGMEM = "pvoutput_connect";
+static const char stagePvOutputPost[] PROGMEM = "pvoutput_post";
+static const char stageDns[] PROGMEM = "dns";
+
+static PGM_P const stageNames[STAGE_COUNT] PROGMEM = {
+    stageLoop,
+    stageLog,
+    stageMqttLoop,
+    stageNtp,
+    stageWeb,
+    stageLed,
+    stageDelay,
+    stageWifi,
+    stageMqttConnect,
+    stageMqttPublish,
+    stageInverter,
+    stagePvOutputConnect,
+    stagePvOutputPost,
+    stageDns,
+};
+
+
+StallDetector::StallDetector(unsigned long thresholdMs):
+    _next(0), _count(0), _total(0), _thresholdMs(thresholdMs), _loopStart(0), _stageStart(0), _worstMs(0), _stage(STAGE_LOOP), _worstStage(STAGE_LOOP) {}
+
+void StallDetector::_account(unsigned long now) {
+    unsigned long elapsed = now - _stageStart;
+    if (elapsed > _worstMs) {
+        _worstMs = elapsed;
+        _worstStage = _stage;
+    }
+    _stageStart = now;
+}
+
+void StallDetector::loopStart() {
+    unsigned long now = millis();
+    _loopStart = now;
+    _stageStart = now;
+    _worstMs = 0;
+    _worstStage = STAGE_LOOP;
+}
+
+const StallDetector::Stall *StallDetector::loopEnd(uint32_t time) {
+    unsigned long now = millis();
+    _account(now);
+    unsigned long duration = now - _loopStart;
+    if (duration < _thresholdMs) {
+        return NULL;
+    }
+    Stall *stall = &_stalls[_next];
+    stall->time = time;
+    stall->durationMs = duration;
+    stall->stageMs = _worstMs;
+    stall->stage = _worstStage;
+    _next = (_next + 1) % STALL_HISTORY;
+    if (_count < STALL_HISTORY) {
+        _count++;
+    }
+    _total++;
+    return stall;
+}
+
+uint8_t StallDetector::enter(uint8_t stage) {
+    uint8_t previous = _stage;
+    _account(millis());
+    _stage = stage;
+    return previous;
+}
+
+uint8_t StallDetector::stage() {
+    return _stage;
+}
+
+unsigned long StallDetector::stageMs() {
+    return millis() - _stageStart;
+}
+
+unsigned long StallDetector::thresholdMs() {
+    return _thresholdMs;
+}
+
+uint8_t StallDetector::count() {
+    return _count;
+}
+
+uint32_t StallDetector::total() {
+    return _total;
+}
+
+const StallDetector::Stall *StallDetector::get(uint8_t i) {
+    if (i >= _count) {
+        return NULL;
+    }
+    return &_stalls[(_next + STALL_HISTORY - 1 - i) % STALL_HISTORY];
+}
+
+PGM_P StallDetector::stageName(uint8_t stage) {
+    if (stage >= STAGE_COUNT) {
+        return PSTR("unknown");
+    }
+    return (PGM_P)pgm_read_ptr(&stageNames[stage]);
+}
@@ -0,0 +1,66 @@
+#ifndef STALL_H
+#define STALL_H
+
+#include <Arduino.h>
+
+#ifndef STALL_HISTORY
+#define STALL_HISTORY 8
+#endif
+
+// Loop stages. Code outside any marked stage is attributed to STAGE_LOOP
+#define STAGE_LOOP             0
+#define STAGE_LOG              1
+#define STAGE_MQTT_LOOP        2
+#define STAGE_NTP              3
+#define STAGE_WEB              4
+#define STAGE_LED              5
+#define STAGE_DELAY            6
+#define STAGE_WIFI             7
+#define STAGE_MQTT_CONNECT     8
+#define STAGE_MQTT_PUBLISH     9
+#define STAGE_INVERTER         10
+#define STAGE_PVOUTPUT_CONNECT 11
+#define STAGE_PVOUTPUT_POST    12
+#define STAGE_DNS              13
+#define STAGE_COUNT            14
+
+
+// Track the active loop stage and record loop iterations that run over a threshold, attributed to the
+// stage that was active for longest during the iteration.
+class StallDetector {
+    public:
+        struct Stall {
+            uint32_t time;
+            uint32_t durationMs;
+            uint32_t stageMs;
+            uint8_t stage;
+        };
+    private:
+        Stall _stalls[STALL_HISTORY];
+        uint8_t _next;
+        uint8_t _count;
+        uint32_t _total;
+        unsigned long _thresholdMs;
+        unsigned long _loopStart;
+        unsigned long _stageStart;
+        unsigned long _worstMs;
+        uint8_t _stage;
+        uint8_t _worstStage;
+        void _account(unsigned long now);
+    public:
+        StallDetector(unsigned long thresholdMs);
+        void loopStart();
+        // Returns the recorded stall if this iteration ran over the threshold, else NULL
+        const Stall *loopEnd(uint32_t time);
+        // Switch to stage, returns the previous stage to restore
+        uint8_t enter(uint8_t stage);
+        uint8_t stage();
+        unsigned long stageMs();
+        unsigned long thresholdMs();
+        uint8_t count();
+        uint32_t total();
+        // i = 0 is the most recent stall
+        const Stall *get(uint8_t i);
+        static PGM_P stageName(uint8_t stage);
+};
+#endif    // STALL_H
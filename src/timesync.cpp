@@ -0,0 +1,152 @@
+#include "timesync.h"
+
+
+#define NTP_PORT 123
+#define NTP_PACKET_SIZE 48
+#define NTP_LOCAL_PORT 2390
+#define NTP_UNIX_OFFSET 2208988800UL // Seconds from 1900 to 1970
+#define NTP_MODE_CLIENT 3
+#define NTP_MODE_SERVER 4
+#define NTP_VERSION 4
+
+
+static uint32_t readBE32(const uint8_t *buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+static void writeBE32(uint8_t *buf, uint32_t val) {
+    buf[0] = val >> 24;
+    buf[1] = val >> 16;
+    buf[2] = val >> 8;
+    buf[3] = val;
+}
+
+// NTP timestamp at offset to microseconds since the unix epoch
+static uint64_t ntpToUs(const uint8_t *buf) {
+    uint32_t seconds = readBE32(buf) - NTP_UNIX_OFFSET;
+    uint32_t fraction = readBE32(buf + 4);
+    return (uint64_t)seconds * 1000000 + (((uint64_t)fraction * 1000000) >> 32);
+}
+
+
+SntpClient::SntpClient(uint32_t intervalMs, ResolveFunc resolve):
+    _serverCount(0), _server(0), _waiting(false), _started(false), _nextMs(0), _sentMs(0), _sentUs(0), _intervalMs(intervalMs),
+    _resolve(resolve), _epochUs(0), _rttUs(0), _requests(0), _responses(0), _timeouts(0) {}
+
+void SntpClient::addServer(const char *host) {
+    if (_serverCount < SNTP_MAX_SERVERS) {
+        _servers[_serverCount++] = host;
+    }
+}
+
+void SntpClient::syncNow() {
+    _nextMs = millis();
+}
+
+bool SntpClient::_send() {
+    IPAddress ip;
+    if (!_resolve(_servers[_server], &ip)) {
+        return false;
+    }
+    uint8_t packet[NTP_PACKET_SIZE] = {0};
+    packet[0] = (NTP_VERSION << 3) | NTP_MODE_CLIENT;
+    // Transmit timestamp is echoed back as the originate timestamp, used to match the reply
+    _sentUs = micros64();
+    writeBE32(&packet[40], _sentUs >> 32);
+    writeBE32(&packet[44], _sentUs);
+    if (!_udp.beginPacket(ip, NTP_PORT)) {
+        return false;
+    }
+    _udp.write(packet, sizeof(packet));
+    if (!_udp.endPacket()) {
+        return false;
+    }
+    _sentMs = millis();
+    _requests++;
+    return true;
+}
+
+bool SntpClient::_receive() {
+    uint8_t packet[NTP_PACKET_SIZE];
+    while (_udp.parsePacket() > 0) {
+        uint64_t receivedUs = micros64();
+        if (_udp.read(packet, sizeof(packet)) != NTP_PACKET_SIZE) {
+            continue;
+        }
+        uint8_t mode = packet[0] & 0x07;
+        uint8_t stratum = packet[1];
+        if (mode != NTP_MODE_SERVER || stratum == 0 || stratum > 15) {
+            continue;
+        }
+        if (readBE32(&packet[24]) != (uint32_t)(_sentUs >> 32) || readBE32(&packet[28]) != (uint32_t)_sentUs) {
+            // Stale or foreign reply
+            continue;
+        }
+        uint64_t serverReceiveUs = ntpToUs(&packet[32]);
+        uint64_t serverTransmitUs = ntpToUs(&packet[40]);
+        int64_t rtt = (int64_t)(receivedUs - _sentUs) - (int64_t)(serverTransmitUs - serverReceiveUs);
+        _rttUs = rtt > 0 ? rtt : 0;
+        // Server time now is its transmit time plus the return path, taken as half the round trip.
+        // Adjust to the current micros64() so the caller can apply it directly.
+        _epochUs = serverTransmitUs + _rttUs / 2 + (micros64() - receivedUs);
+        return true;
+    }
+    return false;
+}
+
+bool SntpClient::loop(bool networkUp) {
+    if (_serverCount == 0 || !networkUp) {
+        return false;
+    }
+    if (!_started) {
+        _udp.begin(NTP_LOCAL_PORT);
+        _started = true;
+    }
+    if (_waiting) {
+        if (_receive()) {
+            _waiting = false;
+            _responses++;
+            _nextMs = millis() + _intervalMs;
+            return true;
+        }
+        if (millis() - _sentMs < SNTP_TIMEOUT_MS) {
+            return false;
+        }
+        // Timed out, move on
+        _waiting = false;
+        _timeouts++;
+        _server = (_server + 1) % _serverCount;
+        _nextMs = millis() + SNTP_RETRY_MS;
+        return false;
+    }
+    if ((long)(millis() - _nextMs) < 0) {
+        return false;
+    }
+    if (_send()) {
+        _waiting = true;
+    } else {
+        _server = (_server + 1) % _serverCount;
+        _nextMs = millis() + SNTP_RETRY_MS;
+    }
+    return false;
+}
+
+uint64_t SntpClient::epochUs() {
+    return _epochUs;
+}
+
+uint32_t SntpClient::rttUs() {
+    return _rttUs;
+}
+
+uint32_t SntpClient::requests() {
+    return _requests;
+}
+
+uint32_t SntpClient::responses() {
+    return _responses;
+}
+
+uint32_t SntpClient::timeouts() {
+    return _timeouts;
+}
@@ -0,0 +1,60 @@
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+#ifndef SNTP_MAX_SERVERS
+#define SNTP_MAX_SERVERS 3
+#endif
+
+#ifndef SNTP_TIMEOUT_MS
+#define SNTP_TIMEOUT_MS 1000 // Reply wait before trying the next server
+#endif
+
+#ifndef SNTP_RETRY_MS
+#define SNTP_RETRY_MS 10000 // Wait after a failed request
+#endif
+
+
+// Asynchronous SNTP client. loop() sends a request and returns; the reply is picked up on a later call.
+// Never waits for the network, servers are tried in turn on timeout. Server names are looked up through resolve
+// on every request, so the caller's cache decides when they are looked up again.
+class SntpClient {
+    public:
+        // Sets ip and returns true if there is a usable address for host
+        typedef bool (*ResolveFunc)(const char *host, IPAddress *ip);
+    private:
+        WiFiUDP _udp;
+        const char *_servers[SNTP_MAX_SERVERS];
+        uint8_t _serverCount;
+        uint8_t _server;
+        bool _waiting;
+        bool _started;
+        unsigned long _nextMs;
+        unsigned long _sentMs;
+        uint64_t _sentUs;
+        uint32_t _intervalMs;
+        ResolveFunc _resolve;
+        uint64_t _epochUs;
+        uint32_t _rttUs;
+        uint32_t _requests;
+        uint32_t _responses;
+        uint32_t _timeouts;
+        bool _send();
+        bool _receive();
+    public:
+        SntpClient(uint32_t intervalMs, ResolveFunc resolve);
+        void addServer(const char *host);
+        // Poll. Returns true when a new sample is available from epochUs()
+        bool loop(bool networkUp);
+        // Request a sync on the next loop()
+        void syncNow();
+        // Server time at the moment loop() returned true, from the clock used by micros64()
+        uint64_t epochUs();
+        uint32_t rttUs();
+        uint32_t requests();
+        uint32_t responses();
+        uint32_t timeouts();
+};
+#endif    // TIMESYNC_H